@@ -0,0 +1,153 @@
+/*
+Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+#include <map>
+#include <mutex>
+
+#include "core/constants.hpp"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+// A process-wide pool of page-aligned anonymous regions for the I/O buffers, vertex windows and
+// bitmaps. Freed regions stay mapped and are handed out again to requests of up to their size (and
+// at least half of it), so the pages of a window loaded in every iteration are faulted in once.
+// Regions can be backed by huge pages: transparent ones (madvise) or explicit 2 MB or 1 GB pages
+// from the hugetlb pool, falling back to transparent ones if the pool is empty. bytes() counts every
+// mapped region, free or not, and is charged against the memory budget by Graph.
+// Environment: GRIDGRAPH_HUGE_PAGES (none, thp, 2mb or 1gb).
+class Arena {
+	std::mutex mutex;
+	std::multimap<long, char *> free_regions;
+	std::map<char *, long> region_bytes;
+	long mapped_bytes;
+	int huge_pages;
+
+	long page_bytes() {
+		switch (huge_pages) {
+		case HUGE_PAGES_THP:
+		case HUGE_PAGES_2MB:
+			return 1l << 21;
+		case HUGE_PAGES_1GB:
+			return 1l << 30;
+		}
+		return 4096;
+	}
+
+	// map bytes (a multiple of page_bytes() if huge) aligned to page_bytes() if huge
+	char * map(long bytes, bool huge) {
+		if (!huge) {
+			void * region = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			assert(region!=MAP_FAILED);
+			return (char *)region;
+		}
+		if (huge_pages==HUGE_PAGES_2MB || huge_pages==HUGE_PAGES_1GB) {
+			int shift = (huge_pages==HUGE_PAGES_2MB) ? 21 : 30;
+			void * region = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0);
+			if (region!=MAP_FAILED) return (char *)region;
+		}
+		long align = page_bytes();
+		char * region = (char *)mmap(NULL, bytes + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		assert(region!=MAP_FAILED);
+		char * aligned = (char *)(((unsigned long)region + align - 1) / align * align);
+		if (aligned > region) munmap(region, aligned - region);
+		if (region + align > aligned) munmap(aligned + bytes, region + align - aligned);
+		madvise(aligned, bytes, MADV_HUGEPAGE);
+		return aligned;
+	}
+public:
+	Arena() {
+		mapped_bytes = 0;
+		huge_pages = HUGE_PAGES_NONE;
+		const char * value = getenv("GRIDGRAPH_HUGE_PAGES");
+		if (value!=NULL) {
+			if (strcmp(value, "thp")==0) {
+				huge_pages = HUGE_PAGES_THP;
+			} else if (strcmp(value, "2mb")==0) {
+				huge_pages = HUGE_PAGES_2MB;
+			} else if (strcmp(value, "1gb")==0) {
+				huge_pages = HUGE_PAGES_1GB;
+			}
+		}
+	}
+
+	// applies to regions mapped from now on
+	void set_huge_pages(int huge_pages) {
+		std::lock_guard<std::mutex> guard(mutex);
+		this->huge_pages = huge_pages;
+	}
+
+	// a region of at least bytes bytes, on huge pages if it fills one; its contents are undefined
+	// unless it is freshly mapped (zero)
+	char * alloc(long bytes) {
+		std::lock_guard<std::mutex> guard(mutex);
+		bool huge = (huge_pages!=HUGE_PAGES_NONE && bytes >= page_bytes());
+		long unit = huge ? page_bytes() : 4096;
+		long rounded = (bytes + unit - 1) / unit * unit;
+		auto it = free_regions.lower_bound(rounded);
+		if (it!=free_regions.end() && it->first <= rounded * 2) {
+			char * region = it->second;
+			free_regions.erase(it);
+			return region;
+		}
+		char * region = map(rounded, huge);
+		region_bytes[region] = rounded;
+		mapped_bytes += rounded;
+		return region;
+	}
+
+	// return a region to the pool
+	void free(void * addr) {
+		if (addr==NULL) return;
+		std::lock_guard<std::mutex> guard(mutex);
+		auto it = region_bytes.find((char *)addr);
+		assert(it!=region_bytes.end());
+		free_regions.insert(std::make_pair(it->second, it->first));
+	}
+
+	// unmap the free regions
+	void trim() {
+		std::lock_guard<std::mutex> guard(mutex);
+		for (auto & region : free_regions) {
+			munmap(region.second, region.first);
+			region_bytes.erase(region.second);
+			mapped_bytes -= region.first;
+		}
+		free_regions.clear();
+	}
+
+	// bytes mapped, in use or pooled
+	long bytes() {
+		return __atomic_load_n(&mapped_bytes, __ATOMIC_RELAXED);
+	}
+};
+
+inline Arena & arena() {
+	static Arena pool;
+	return pool;
+}
+
+#endif
@@ -19,33 +19,210 @@ Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
+#include <vector>
+#include <type_traits>
+
+// Atomic primitives on plain memory (vertex data lives in mmap'ed BigVectors, not std::atomic).
+// Integers use the native read-modify-write instructions; other types of 1, 2, 4, 8 or 16 bytes
+// go through a compare-and-swap loop on their bit pattern. Every operation takes a memory order
+// (__ATOMIC_RELAXED, __ATOMIC_ACQUIRE, __ATOMIC_RELEASE, __ATOMIC_SEQ_CST), sequentially
+// consistent by default as the __sync builtins these replace.
+
+template <size_t bytes> struct AtomicWord { };
+template <> struct AtomicWord<1> { typedef unsigned char type; };
+template <> struct AtomicWord<2> { typedef unsigned short type; };
+template <> struct AtomicWord<4> { typedef unsigned int type; };
+template <> struct AtomicWord<8> { typedef unsigned long type; };
+template <> struct AtomicWord<16> { typedef unsigned __int128 type; };
+
+template <class ET>
+inline typename AtomicWord<sizeof(ET)>::type atomic_bits(const ET & v) {
+	typename AtomicWord<sizeof(ET)>::type bits = 0;
+	memcpy(&bits, &v, sizeof(ET));
+	return bits;
+}
+
+template <class ET>
+inline ET atomic_value(typename AtomicWord<sizeof(ET)>::type bits) {
+	ET v;
+	memcpy(&v, &bits, sizeof(ET));
+	return v;
+}
+
+inline int atomic_failure_order(int order) {
+	if (order==__ATOMIC_RELEASE) return __ATOMIC_RELAXED;
+	if (order==__ATOMIC_ACQ_REL) return __ATOMIC_ACQUIRE;
+	return order;
+}
+
+// 16-byte compare-and-swap; cmpxchg16b on x86-64, libatomic elsewhere (link with -latomic)
+inline bool cas_16(unsigned __int128 * ptr, unsigned __int128 oldv, unsigned __int128 newv) {
+#if defined(__x86_64__)
+	bool swapped;
+	unsigned long old_lo = (unsigned long)oldv, old_hi = (unsigned long)(oldv >> 64);
+	asm volatile("lock cmpxchg16b %1"
+		: "=@ccz"(swapped), "+m"(*ptr), "+a"(old_lo), "+d"(old_hi)
+		: "b"((unsigned long)newv), "c"((unsigned long)(newv >> 64))
+		: "memory");
+	return swapped;
+#else
+	return __atomic_compare_exchange(ptr, &oldv, &newv, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
 template <class ET>
-inline bool cas(ET *ptr, ET oldv, ET newv) {
-	if (sizeof(ET) == 8) {
-		return __sync_bool_compare_and_swap((long*)ptr, *((long*)&oldv), *((long*)&newv));//这两个函数提供原子的比较和交换，如果*ptr == oldval,就将newval写入*ptr,
-		//函数在相等并写入的情况下返回true.
-	} else if (sizeof(ET) == 4) {
-		return __sync_bool_compare_and_swap((int*)ptr, *((int*)&oldv), *((int*)&newv));
-	} else {
-		assert(false);
+inline ET atomic_load(ET *ptr, int order, std::true_type) {
+	// a 16-byte load is a compare-and-swap that leaves the value unchanged
+	unsigned __int128 bits = *(volatile unsigned __int128 *)ptr;
+	while (!cas_16((unsigned __int128 *)ptr, bits, bits)) bits = *(volatile unsigned __int128 *)ptr;
+	return atomic_value<ET>(bits);
+}
+
+template <class ET>
+inline ET atomic_load(ET *ptr, int order, std::false_type) {
+	return atomic_value<ET>(__atomic_load_n((typename AtomicWord<sizeof(ET)>::type *)ptr, order));
+}
+
+template <class ET>
+inline ET atomic_load(ET *ptr, int order = __ATOMIC_SEQ_CST) {
+	return atomic_load(ptr, order, std::integral_constant<bool, sizeof(ET) == 16>());
+}
+
+template <class ET>
+inline void atomic_store(ET *ptr, ET v, int order = __ATOMIC_SEQ_CST) {
+	typedef typename AtomicWord<sizeof(ET)>::type W;
+	static_assert(sizeof(ET) < 16, "16-byte stores must use cas");
+	__atomic_store_n((W *)ptr, atomic_bits(v), order);
+}
+
+template <class ET>
+inline bool cas(ET *ptr, ET oldv, ET newv, int order, std::true_type) {
+	return cas_16((unsigned __int128 *)ptr, atomic_bits(oldv), atomic_bits(newv));
+}
+
+template <class ET>
+inline bool cas(ET *ptr, ET oldv, ET newv, int order, std::false_type) {
+	typename AtomicWord<sizeof(ET)>::type expected = atomic_bits(oldv);
+	//如果*ptr == oldv,就将newv写入*ptr,函数在相等并写入的情况下返回true.
+	return __atomic_compare_exchange_n((typename AtomicWord<sizeof(ET)>::type *)ptr, &expected, atomic_bits(newv), false, order, atomic_failure_order(order));
+}
+
+template <class ET>
+inline bool cas(ET *ptr, ET oldv, ET newv, int order = __ATOMIC_SEQ_CST) {
+	return cas(ptr, oldv, newv, order, std::integral_constant<bool, sizeof(ET) == 16>());
+}
+
+template <class ET>
+inline ET fetch_add(ET *a, ET b, int order, std::true_type) {
+	return __atomic_fetch_add(a, b, order);
+}
+
+template <class ET>
+inline ET fetch_add(ET *a, ET b, int order, std::false_type) {
+	ET oldV = atomic_load(a, __ATOMIC_RELAXED);
+	while (!cas(a, oldV, (ET)(oldV + b), order)) {
+		oldV = atomic_load(a, __ATOMIC_RELAXED);
 	}
+	return oldV;
+}
+
+// atomically adds b to *a and returns the previous value
+template <class ET>
+inline ET fetch_add(ET *a, ET b, int order = __ATOMIC_SEQ_CST) {
+	return fetch_add(a, b, order, std::integral_constant<bool, std::is_integral<ET>::value && sizeof(ET) <= 8>());
+}
+
+template <class ET>
+inline void write_add(ET *a, ET b, int order = __ATOMIC_SEQ_CST) {
+	fetch_add(a, b, order);
+}
+
+template <class ET>
+inline ET write_or(ET *a, ET b, int order = __ATOMIC_SEQ_CST) {
+	return __atomic_fetch_or(a, b, order);
 }
 
+// returns whether *a was lowered to b
 template <class ET>
-inline bool write_min(ET *a, ET b) {
-	ET c; bool r=0;
-	do c = *a;
-	while (c > b && !(r=cas(a,c,b)));
-	return r;
+inline bool write_min(ET *a, ET b, int order = __ATOMIC_SEQ_CST) {
+	ET c = atomic_load(a, __ATOMIC_RELAXED);
+	while (b < c) {
+		if (cas(a, c, b, order)) return true;
+		c = atomic_load(a, __ATOMIC_RELAXED);
+	}
+	return false;
 }
 
+// returns whether *a was raised to b
 template <class ET>
-inline void write_add(ET *a, ET b) {
-	volatile ET newV, oldV;
-	do {oldV = *a; newV = oldV + b;}
-	while (!cas(a, oldV, newV));
+inline bool write_max(ET *a, ET b, int order = __ATOMIC_SEQ_CST) {
+	ET c = atomic_load(a, __ATOMIC_RELAXED);
+	while (c < b) {
+		if (cas(a, c, b, order)) return true;
+		c = atomic_load(a, __ATOMIC_RELAXED);
+	}
+	return false;
+}
+
+// An allocator that honors alignas on the element type, which std::allocator does not for
+// over-aligned types before C++17; lets std::vector hold one cache line per thread.
+template <class T>
+struct AlignedAllocator {
+	typedef T value_type;
+	AlignedAllocator() { }
+	template <class U>
+	AlignedAllocator(const AlignedAllocator<U> &) { }
+	T * allocate(size_t n) {
+		void * p = NULL;
+		size_t align = alignof(T) < sizeof(void *) ? sizeof(void *) : alignof(T);
+		if (posix_memalign(&p, align, n * sizeof(T) > 0 ? n * sizeof(T) : align)!=0) {
+			fprintf(stderr, "out of memory allocating %lu aligned bytes\n", n * sizeof(T));
+			exit(-1);
+		}
+		return (T *)p;
+	}
+	void deallocate(T * p, size_t) {
+		free(p);
+	}
+};
+
+template <class T, class U>
+bool operator==(const AlignedAllocator<T> &, const AlignedAllocator<U> &) {
+	return true;
 }
 
+template <class T, class U>
+bool operator!=(const AlignedAllocator<T> &, const AlignedAllocator<U> &) {
+	return false;
+}
+
+// One cache line per thread for results accumulated by parallel loops, summed once at the end
+// instead of every thread adding into a shared value.
+template <class ET>
+class Reducer {
+	struct alignas(64) Slot {
+		ET value;
+	};
+	std::vector<Slot, AlignedAllocator<Slot> > slots;
+public:
+	Reducer(int threads, ET zero = 0) : slots(threads) {
+		for (int i=0;i<threads;i++) {
+			slots[i].value = zero;
+		}
+	}
+	ET & operator[](int thread_id) {
+		return slots[thread_id].value;
+	}
+	ET sum(ET zero = 0) {
+		ET value = zero;
+		for (size_t i=0;i<slots.size();i++) {
+			value += slots[i].value;
+		}
+		return value;
+	}
+};
+
 #endif
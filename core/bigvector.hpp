@@ -24,9 +24,14 @@ Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
 #include <omp.h>
 
 #include <thread>
+#include <vector>
+#include <algorithm>
 
+#include "core/constants.hpp"
 #include "core/filesystem.hpp"
 #include "core/partition.hpp"
+#include "core/numa.hpp"
+#include "core/arena.hpp"
 
 template <typename T>
 class BigVector
@@ -37,6 +42,183 @@ class BigVector
 	size_t begin_i = 0, end_i = 0;
 	T *data_in_memory = NULL;
 	static const long PAGESIZE = 4096;
+	int window_mode = WINDOW_READ_WRITE;
+	// pages of a marked window written since load, flagged by mark_dirty()
+	std::vector<char> page_dirty;
+	std::thread writer;
+	// with a lazy default, pages of the mapping are filled with default_value on first access
+	bool lazy = false;
+	char default_value[sizeof(T)];
+	std::vector<char> page_state;
+	enum {PAGE_UNTOUCHED, PAGE_FILLING, PAGE_READY};
+	// whether the untouched pages can be told apart as holes when the file is opened again, which
+	// needs whole entries per page and file system blocks no larger than a page
+	bool holes_persist = false;
+	// set_default(value, true): leave the untouched pages as holes, with the default in a sidecar
+	bool sparse = false;
+
+	size_t page_of(size_t i)
+	{
+		return i * sizeof(T) / PAGESIZE;
+	}
+	// fill the entries starting in page with the default, unless another thread does or did
+	void materialize_page(size_t page)
+	{
+		char *state = &page_state[page];
+		char expected = PAGE_UNTOUCHED;
+		if (__atomic_compare_exchange_n(state, &expected, (char)PAGE_FILLING, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+		{
+			size_t first = (page * PAGESIZE + sizeof(T) - 1) / sizeof(T);
+			size_t last = std::min(length, ((page + 1) * PAGESIZE + sizeof(T) - 1) / sizeof(T));
+			for (size_t i = first; i < last; i++)
+			{
+				memcpy((void *)&data[i], default_value, sizeof(T));
+			}
+			__atomic_store_n(state, (char)PAGE_READY, __ATOMIC_RELEASE);
+			return;
+		}
+		while (__atomic_load_n(state, __ATOMIC_ACQUIRE) != PAGE_READY)
+		{
+			std::this_thread::yield();
+		}
+	}
+	// drop the file contents, which then read as zero; false if the file system cannot punch holes
+	bool punch()
+	{
+		wait_writeback();
+		return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, sizeof(T) * length) == 0;
+	}
+	std::string default_path()
+	{
+		return path + ".default";
+	}
+	// keep the default of a lazy vector in a sidecar file, so that init() reads the pages still
+	// untouched (the holes of the file) as the default; remove it once the vector is not lazy
+	void persist_default()
+	{
+		if (!lazy || !sparse)
+		{
+			if (file_exists(default_path()))
+				unlink(default_path().c_str());
+			return;
+		}
+		FILE *fout = fopen(default_path().c_str(), "wb");
+		assert(fout != NULL);
+		size_t written = fwrite(default_value, sizeof(T), 1, fout);
+		assert(written == 1);
+		fclose(fout);
+	}
+	// read the default left by persist_default(): the pages that are holes are untouched
+	void restore_default()
+	{
+		FILE *fin = fopen(default_path().c_str(), "rb");
+		if (fin == NULL)
+			return;
+		size_t read = fread(default_value, sizeof(T), 1, fin);
+		fclose(fin);
+		if (read != 1 || length == 0)
+			return;
+		size_t pages = page_of(length - 1) + 1;
+		page_state.assign(pages, PAGE_READY);
+		off_t end = sizeof(T) * length;
+		off_t hole = lseek(fd, 0, SEEK_HOLE);
+		while (hole >= 0 && hole < end)
+		{
+			off_t next = lseek(fd, hole, SEEK_DATA);
+			if (next < 0) // no data after the hole
+				next = end;
+			for (size_t page = (hole + PAGESIZE - 1) / PAGESIZE; page < pages && std::min((off_t)(page + 1) * PAGESIZE, end) <= next; page++)
+			{
+				page_state[page] = PAGE_UNTOUCHED;
+			}
+			if (next >= end)
+				break;
+			hole = lseek(fd, next, SEEK_HOLE);
+		}
+		lazy = true;
+		sparse = true;
+	}
+
+	long window_pages()
+	{
+		return ((end_i - begin_i) * sizeof(T) + PAGESIZE - 1) / PAGESIZE;
+	}
+	// read the pages of the window covering file bytes [offset, end_offset)
+	void read_pages(long offset, long end_offset)
+	{
+		long bytes;
+		while (offset < end_offset)
+		{
+			bytes = pread(fd, (char *)data_in_memory + (offset - (long)(begin_i * sizeof(T))), (end_offset - offset + PAGESIZE - 1) / PAGESIZE * PAGESIZE, offset);
+			if (bytes == -1)
+			{
+				printf("%ld %ld\n", offset, end_offset);
+				printf("%s\n", strerror(errno));
+				getchar();
+				exit(-1);
+			}
+			offset += bytes;
+		}
+	}
+	// write back the dirty pages of the window (the marked ones of a marked window, none of a
+	// read-only one, all of them otherwise), merged into runs, then return the window to the arena;
+	// in the background if async is set
+	void writeback(bool async)
+	{
+		std::vector<std::pair<long, long>> runs;
+		if (window_mode != WINDOW_READ_ONLY)
+		{
+			long pages = window_pages();
+			std::vector<char> dirty(pages, 1);
+			if (window_mode == WINDOW_MARKED)
+				dirty.swap(page_dirty);
+			long base = begin_i * sizeof(T);
+			for (long p = 0; p < pages; p++)
+			{
+				if (!dirty[p])
+					continue;
+				if (!runs.empty() && runs.back().first + runs.back().second == base + p * PAGESIZE)
+					runs.back().second += PAGESIZE;
+				else
+					runs.push_back(std::make_pair(base + p * PAGESIZE, PAGESIZE));
+			}
+		}
+		int fd = this->fd;
+		char *window = (char *)data_in_memory;
+		long base = begin_i * sizeof(T);
+		auto write_runs = [fd, window, base, runs]() {
+			for (auto &run : runs)
+			{
+				for (long done = 0; done < run.second;)
+				{
+					long bytes = pwrite(fd, window + (run.first - base) + done, run.second - done, run.first + done);
+					if (bytes == -1)
+					{
+						printf("%ld %ld\n", run.first + done, run.first + run.second);
+						printf("%s\n", strerror(errno));
+						exit(-1);
+					}
+					done += bytes;
+				}
+			}
+			arena().free(window);
+		};
+		if (async)
+		{
+			// the calling thread may be a pinned worker (the master thread with GRIDGRAPH_PIN)
+			writer = std::thread([write_runs]() {
+				if (numa().pin)
+					numa().unpin_thread();
+				write_runs();
+			});
+		}
+		else
+			write_runs();
+		in_memory = false;
+		begin_i = 0;
+		end_i = 0;
+		open_mmap();
+	}
 
   public:
 	int fd;
@@ -58,6 +240,10 @@ class BigVector
 	}
 	~BigVector()
 	{
+		wait_writeback();
+		// the file ends up as after fill(), unless its untouched pages are meant to stay holes
+		if (is_open && !sparse)
+			materialize();
 		if (is_open && file_exists(path))
 		{
 			close_mmap();
@@ -75,6 +261,9 @@ class BigVector
 		this->length = length;
 		if (!file_exists(path))
 		{
+			// a default left by an earlier file of the same name does not apply to this one
+			if (file_exists(default_path()))
+				unlink(default_path().c_str());
 			FILE *fout = fopen(path.c_str(), "wb");//FILE * fopen(const char * path,const char * mode);
 			//文件顺利打开后，指向该流的文件指针就会被返回。如果文件打开失败则返回NULL，并把错误代码存在errno 中。
 			fclose(fout);
@@ -85,26 +274,16 @@ class BigVector
 			assert(truncate(path.c_str(), file_length) != -1); //int truncate(const char * path, off_t length);
 			//函数说明：truncate()会将参数path 指定的文件大小改为参数length 指定的大小. 如果原来的文件大小比参数length 大, 则超过的部分会被删去.
 			//返回值：执行成功则返回0, 失败返回-1, 错误原因存于errno.
-			int fout = open(path.c_str(), O_WRONLY);
-			void *buffer = memalign(PAGESIZE, PAGESIZE); //void * memalign (size_t boundary, size_t size)
-			//函数memalign将分配一个由size指定大小，地址是boundary的倍数的内存块。参数boundary必须是2的幂！函数memalign可以分配较大的内存块，并且可以为返回的地址指定粒度。
-			for (long offset = 0; offset < file_length;)
-			{
-				if (file_length - offset > PAGESIZE)
-				{
-					assert(write(fout, buffer, PAGESIZE) == PAGESIZE); // ssize_t write(int fd, const void *buf, size_t count); 返回值：成功返回写入的字节数，出错返回-1并设置errno
-					offset += PAGESIZE;
-				}
-				else
-				{
-					assert(write(fout, buffer, file_length - offset) == file_length - offset);
-					offset += file_length - offset;
-				}
-			}
-			close(fout);
+			// the new part is left sparse and reads as zero
 		}
 		fd = open(path.c_str(), O_RDWR | O_DIRECT);
 		assert(fd != -1);
+		struct stat st;
+		holes_persist = PAGESIZE % sizeof(T) == 0 && fstat(fd, &st) == 0 && st.st_blksize <= PAGESIZE;
+		lazy = false;
+		sparse = false;
+		if (holes_persist && file_exists(default_path()))
+			restore_default();
 		open_mmap();
 	}
 	void open_mmap()
@@ -117,6 +296,7 @@ class BigVector
 		//若映射成功则返回映射区的内存起始地址，否则返回MAP_FAILED(－1)，错误原因存于errno 中
 		data = (T *)mmap(NULL, sizeof(T) * length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 		assert(data != MAP_FAILED);
+		numa().place(data, sizeof(T) * length, numa().placement);
 		is_open = true;
 	}
 	void close_mmap()
@@ -125,9 +305,20 @@ class BigVector
 		int ret = munmap(data, sizeof(T) * length); //munmap执行相反的操作，删除特定地址区域的对象映射。 成功返回0
 		assert(ret == 0);
 	}
+	// set every entry to value; a zero value only punches out the file contents
 	void fill(const T &value)//填充
 	{
-		int parallelism = std::thread::hardware_concurrency();
+		const char *bytes = (const char *)&value;
+		bool zero = std::all_of(bytes, bytes + sizeof(T), [](char c) { return c == 0; });
+		if (zero && punch())
+		{
+			lazy = false;
+			persist_default();
+			return;
+		}
+		lazy = false;
+		persist_default();
+		int parallelism = numa().threads;
 		#pragma omp parallel num_threads(parallelism)
 		{
 			size_t begin_i, end_i;
@@ -140,6 +331,54 @@ class BigVector
 		}
 		#pragma omp barrier
 	}
+	// discard the contents and let every entry read as value until written, in O(1): the file
+	// contents are punched out and each page is filled on its first access through operator[].
+	// Accessing data directly needs materialize() first; load(), lock(), sync() and the destructor
+	// materialize what they touch, so the file ends up as after fill(value). With persist_sparse,
+	// where holes can be told apart from written pages, the destructor leaves the untouched pages
+	// as holes and keeps the default in <path>.default for the next init(); other readers of the file
+	// see zeros there. Falls back to fill() if the file system cannot punch holes.
+	void set_default(const T &value, bool persist_sparse = false)
+	{
+		if (!punch())
+		{
+			fill(value);
+			return;
+		}
+		const char *bytes = (const char *)&value;
+		// a hole already reads as zero
+		if (std::all_of(bytes, bytes + sizeof(T), [](char c) { return c == 0; }))
+		{
+			lazy = false;
+			persist_default();
+			return;
+		}
+		memcpy(default_value, &value, sizeof(T));
+		page_state.assign(page_of(length - 1) + 1, PAGE_UNTOUCHED);
+		lazy = (length > 0);
+		sparse = persist_sparse && holes_persist;
+		persist_default();
+	}
+	// fill the untouched pages of [begin_i, end_i) with the default value
+	void materialize(size_t begin_i = 0, size_t end_i = (size_t)-1)
+	{
+		if (!lazy)
+			return;
+		end_i = std::min(end_i, length);
+		if (begin_i >= end_i)
+			return;
+		long first = page_of(begin_i), last = page_of(end_i - 1);
+		#pragma omp parallel for num_threads(numa().threads)
+		for (long page = first; page <= last; page++)
+		{
+			materialize_page(page);
+		}
+		if (begin_i == 0 && end_i == length)
+		{
+			lazy = false;
+			persist_default();
+		}
+	}
 	T &operator[](size_t i)
 	{
 		if (in_memory)
@@ -153,23 +392,44 @@ class BigVector
 		}
 		else
 		{
+			if (lazy && __atomic_load_n(&page_state[page_of(i)], __ATOMIC_ACQUIRE) != PAGE_READY)
+				materialize_page(page_of(i));
 			return data[i];
 		}
 	}
+	// print the NUMA nodes of the resident pages and the remote-access ratio of the static ranges
+	void report_placement()
+	{
+		if (in_memory)
+			numa().report(path.c_str(), data_in_memory, (end_i - begin_i) * sizeof(T));
+		else
+			numa().report(path.c_str(), data, length * sizeof(T));
+	}
 	void sync()
 	{
+		wait_writeback();
+		materialize();
 		assert(msync(data, sizeof(T) * length, MS_SYNC) == 0);
 	}
 	void lock(size_t begin_i, size_t end_i)
 	{
+		wait_writeback();
+		materialize(begin_i, end_i);
 		assert(mlock(data + begin_i, (end_i - begin_i) * sizeof(T)) == 0);
 	}
 	void unlock(size_t begin_i, size_t end_i)
 	{
 		assert(munlock(data + begin_i, (end_i - begin_i) * sizeof(T)) == 0);
 	}
-	void load(size_t begin_i, size_t end_i)
+	// load [begin_i, end_i) into memory, where operator[] serves it until save(). A read-write window
+	// is written back whole; a marked window is read like a read-write one, but save() writes back
+	// only the pages the caller passed to mark_dirty(); a read-only window is never written back; a
+	// write-only window, whose entries the caller overwrites, is not read except for the pages it
+	// shares with the neighbouring windows, and is written back whole
+	void load(size_t begin_i, size_t end_i, int mode = WINDOW_READ_WRITE)
 	{
+		wait_writeback();
+		materialize(begin_i, end_i);
 		close_mmap();//析构了data。只用data_in_memory
 		begin_i = begin_i * sizeof(T) / PAGESIZE * PAGESIZE / sizeof(T); //每一页的重要性，按页存取
 		this->begin_i = begin_i;
@@ -177,47 +437,56 @@ class BigVector
 		in_memory = true;
 		// data_in_memory = (T *)memalign(PAGESIZE, (end_i - begin_i) * sizeof(T) + PAGESIZE);
 		// assert(data_in_memory!=NULL);
-		data_in_memory = (T *)mmap(0, (end_i - begin_i) * sizeof(T) + PAGESIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-		assert(data_in_memory != MAP_FAILED);
+		// windows come from the arena, so loading a window of the same size again reuses faulted pages
+		data_in_memory = (T *)arena().alloc((end_i - begin_i) * sizeof(T) + PAGESIZE);
+		numa().place(data_in_memory, (end_i - begin_i) * sizeof(T) + PAGESIZE, numa().placement);
+		window_mode = mode;
 		long end_offset = end_i * sizeof(T);
 		long offset = begin_i * sizeof(T);
-		long bytes;
-		while (offset < end_offset)
+		if (mode == WINDOW_WRITE_ONLY)
 		{
-			bytes = pread(fd, data_in_memory + (offset / sizeof(T) - begin_i), (end_offset - offset + PAGESIZE - 1) / PAGESIZE * PAGESIZE, offset);
-			if (bytes == -1)
-			{
-				printf("%ld %ld\n", offset, end_offset);
-				printf("%s\n", strerror(errno));
-				getchar();
-				exit(-1);
-			}
-			offset += bytes;
+			long last = (end_offset - 1) / PAGESIZE * PAGESIZE;
+			read_pages(offset, std::min(offset + PAGESIZE, end_offset));
+			if (last > offset)
+				read_pages(last, end_offset);
+		}
+		else
+		{
+			read_pages(offset, end_offset);
 		}
+		if (mode == WINDOW_MARKED)
+			page_dirty.assign(window_pages(), 0);
 	}
-	void save()
+	// flag the pages of a marked window that hold entries [begin_i, end_i) as written; safe to call
+	// from several threads, and a no-op for any other window or outside a window
+	void mark_dirty(size_t begin_i, size_t end_i)
 	{
-		long end_offset = end_i * sizeof(T);
-		long offset = begin_i * sizeof(T);
-		long bytes;
-		while (offset < end_offset)
+		begin_i = std::max(begin_i, this->begin_i);
+		end_i = std::min(end_i, this->end_i);
+		if (!in_memory || window_mode != WINDOW_MARKED || begin_i >= end_i)
+			return;
+		long base = this->begin_i * sizeof(T);
+		long first = (begin_i * sizeof(T) - base) / PAGESIZE, last = (end_i * sizeof(T) - 1 - base) / PAGESIZE;
+		for (long p = first; p <= last; p++)
 		{
-			bytes = pwrite(fd, data_in_memory + (offset / sizeof(T) - begin_i), (end_offset - offset + PAGESIZE - 1) / PAGESIZE * PAGESIZE, offset);
-			if (bytes == -1)
-			{
-				printf("%ld %ld\n", offset, end_offset);
-				printf("%s\n", strerror(errno));
-				getchar();
-				exit(-1);
-			}
-			offset += bytes;
+			if (!__atomic_load_n(&page_dirty[p], __ATOMIC_RELAXED))
+				__atomic_store_n(&page_dirty[p], (char)1, __ATOMIC_RELAXED);
 		}
-		int ret = munmap(data_in_memory, (end_i - begin_i) * sizeof(T) + PAGESIZE);
-		assert(ret == 0);
-		in_memory = false;
-		begin_i = 0;
-		end_i = 0;
-		open_mmap();
+	}
+	void save()
+	{
+		writeback(false);
+	}
+	// like save(), but the dirty pages are written by a background thread; data must not be used
+	// until wait_writeback(), which load(), save(), sync(), lock() and the destructor call as well
+	void save_async()
+	{
+		writeback(true);
+	}
+	void wait_writeback()
+	{
+		if (writer.joinable())
+			writer.join();
 	}
 };
 
@@ -17,23 +17,115 @@ Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
 #ifndef BITMAP_H
 #define BITMAP_H
 
-#define WORD_OFFSET(i) (i >> 6)
-#define BIT_OFFSET(i) (i & 0x3f)//00111111
+#include <string.h>
 
+#include <vector>
+#include <algorithm>
+
+#include "core/type.hpp"
+#include "core/numa.hpp"
+#include "core/arena.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BITMAP_AVX2 1
+#endif
+
+#define WORD_OFFSET(i) ((i) >> 6)
+#define BIT_OFFSET(i) ((i) & 0x3f)//00111111
+
+#ifdef BITMAP_AVX2
+// nibble lookup popcount of 4 words per step, summed with psadbw
+__attribute__((target("avx2")))
+inline size_t popcount_words_avx2(const unsigned long * words, size_t count) {
+	const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low = _mm256_set1_epi8(0x0f);
+	__m256i total = _mm256_setzero_si256();
+	size_t i = 0;
+	for (;i+4<=count;i+=4) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(words + i));
+		__m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low));
+		__m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+		total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+	}
+	unsigned long lanes[4];
+	_mm256_storeu_si256((__m256i *)lanes, total);
+	size_t bits = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	for (;i<count;i++) {
+		bits += __builtin_popcountl(words[i]);
+	}
+	return bits;
+}
+
+inline bool bitmap_has_avx2() {
+	static bool supported = __builtin_cpu_supports("avx2");
+	return supported;
+}
+#endif
+
+// number of set bits in words[0, count)
+inline size_t popcount_words(const unsigned long * words, size_t count) {
+#ifdef BITMAP_AVX2
+	if (count >= 4 && bitmap_has_avx2()) return popcount_words_avx2(words, count);
+#endif
+	size_t bits = 0;
+	for (size_t i=0;i<count;i++) {
+		bits += __builtin_popcountl(words[i]);
+	}
+	return bits;
+}
+
+// A bitmap with two summary levels: bit w of word_summary is set iff data[w] is not zero, and bit s
+// of group_summary iff word_summary[s] is not zero (a group of 4096 words, 262144 vertices).
+// set_bit and clear_bit only touch the summaries when a word becomes non-zero or zero, so any()
+// and the scans below skip empty regions 4096 or 262144 vertices at a time, and count() runs a
+// SIMD popcount over the non-empty groups of words only. Code that writes data directly must call
+// rebuild_summaries() afterwards.
 class Bitmap {
+	// word w was cleared to zero: clear its summary bits, unless a concurrent set_bit refilled it
+	void unmark_word(size_t w) {
+		unsigned long * summary = word_summary + (w >> 6);
+		unsigned long bit = 1ul << (w & 63);
+		if ((__sync_fetch_and_and(summary, ~bit) & ~bit)==0) {
+			unsigned long * group = group_summary + (w >> 12);
+			unsigned long group_bit = 1ul << ((w >> 6) & 63);
+			__sync_fetch_and_and(group, ~group_bit);
+			if (__atomic_load_n(summary, __ATOMIC_SEQ_CST)!=0) __sync_fetch_and_or(group, group_bit);
+		}
+		if (__atomic_load_n(data + w, __ATOMIC_SEQ_CST)!=0) mark_word(w);
+	}
 public:
 	size_t size;
 	unsigned long * data;
+	unsigned long * word_summary;
+	unsigned long * group_summary;
+	size_t summary_words;
+	size_t group_words;
 	Bitmap() {
 		size = 0;
 		data = NULL;
+		word_summary = NULL;
+		group_summary = NULL;
+		summary_words = 0;
+		group_words = 0;
 	}
 	Bitmap(size_t size) {
 		init(size);
 	}
+	Bitmap(const Bitmap &) = delete;
+	virtual ~Bitmap() {
+		arena().free(data);
+	}
 	void init(size_t size) {
 		this->size = size;
-		data = new unsigned long [WORD_OFFSET(size)+1];//分成64份
+		size_t words = WORD_OFFSET(size)+1;//分成64份
+		summary_words = (words + 63) / 64;
+		group_words = (summary_words + 63) / 64;
+		data = (unsigned long *)arena().alloc(sizeof(unsigned long) * (words + summary_words + group_words));
+		word_summary = data + words;
+		group_summary = word_summary + summary_words;
+		numa().place(data, sizeof(unsigned long) * words, numa().placement);
 	}
 	void clear() {
 		size_t bm_size = WORD_OFFSET(size);
@@ -42,6 +134,7 @@ public:
 			data[i] = 0;
 		}
 		#pragma omp barrier
+		memset(word_summary, 0, sizeof(unsigned long) * (summary_words + group_words));
 	}
 	void fill() {
 		size_t bm_size = WORD_OFFSET(size);
@@ -54,12 +147,119 @@ public:
 		for (size_t i=(bm_size<<6);i<size;i++) {
 			data[bm_size] |= 1ul << BIT_OFFSET(i);//
 		}
+		rebuild_summaries();
+	}
+	// recompute both summary levels from data
+	void rebuild_summaries() {
+		size_t words = WORD_OFFSET(size) + 1;
+		#pragma omp parallel for
+		for (size_t s=0;s<summary_words;s++) {
+			unsigned long summary = 0;
+			for (size_t w=s<<6;w<std::min(words, (s+1)<<6);w++) {
+				if (data[w]!=0) summary |= 1ul << (w & 63);
+			}
+			word_summary[s] = summary;
+		}
+		#pragma omp barrier
+		for (size_t g=0;g<group_words;g++) {
+			unsigned long group = 0;
+			for (size_t s=g<<6;s<std::min(summary_words, (g+1)<<6);s++) {
+				if (word_summary[s]!=0) group |= 1ul << (s & 63);
+			}
+			group_summary[g] = group;
+		}
 	}
 	unsigned long get_bit(size_t i) {
 		return data[WORD_OFFSET(i)] & (1ul<<BIT_OFFSET(i));// 1UL 无符号长整型 1
 	}
+	// calls f(w, bits) in increasing order for the non-zero words w of [begin, end), with the bits
+	// outside the range masked out, until f returns true; returns whether it did
+	template <typename F>
+	bool for_each_word(size_t begin, size_t end, F f) {
+		if (begin >= end) return false;
+		size_t first = WORD_OFFSET(begin);
+		size_t last = WORD_OFFSET(end - 1);
+		unsigned long head = ~0ul << BIT_OFFSET(begin);
+		unsigned long tail = ~0ul >> (63 - BIT_OFFSET(end - 1));
+		size_t s = first >> 6;
+		while (s <= (last >> 6)) {
+			unsigned long groups = group_summary[s >> 6] & (~0ul << (s & 63));
+			if (groups==0) {
+				s = ((s >> 6) + 1) << 6;
+				continue;
+			}
+			s = (s & ~63ul) + __builtin_ctzl(groups);
+			if (s > (last >> 6)) break;
+			unsigned long words = word_summary[s];
+			if (s==(first >> 6)) words &= ~0ul << (first & 63);
+			while (words!=0) {
+				size_t w = (s << 6) + __builtin_ctzl(words);
+				if (w > last) return false;
+				unsigned long bits = data[w];
+				if (w==first) bits &= head;
+				if (w==last) bits &= tail;
+				if (bits!=0 && f(w, bits)) return true;
+				words &= words - 1;
+			}
+			s++;
+		}
+		return false;
+	}
+	// whether any bit in [begin, end) is set
+	bool any(size_t begin, size_t end) {
+		return for_each_word(begin, end, [](size_t, unsigned long){ return true; });
+	}
+	virtual size_t count() {
+		size_t words = WORD_OFFSET(size) + 1;
+		size_t bits = 0;
+		#pragma omp parallel for reduction(+:bits)
+		for (size_t s=0;s<summary_words;s++) {
+			if (word_summary[s]!=0) {
+				bits += popcount_words(data + (s << 6), std::min((size_t)64, words - (s << 6)));
+			}
+		}
+		return bits;
+	}
+	// number of set bits in [begin, end)
+	size_t count(size_t begin, size_t end) {
+		if (begin >= end) return 0;
+		size_t last_bit = end - 1;
+		size_t first = WORD_OFFSET(begin);
+		size_t last = WORD_OFFSET(last_bit);
+		unsigned long head = ~0ul << BIT_OFFSET(begin);
+		unsigned long tail = ~0ul >> (63 - BIT_OFFSET(last_bit));
+		if (first==last) return __builtin_popcountl(data[first] & head & tail);
+		size_t bits = __builtin_popcountl(data[first] & head) + __builtin_popcountl(data[last] & tail);
+		if (first + 1 == last) return bits;
+		for (size_t s=(first+1)>>6;s<=((last-1)>>6);s++) {
+			if (word_summary[s]==0) continue;
+			size_t w = std::max(first + 1, s << 6);
+			size_t w_end = std::min(last, (s + 1) << 6);
+			bits += popcount_words(data + w, w_end - w);
+		}
+		return bits;
+	}
 	void set_bit(size_t i) {//只是为了标志该顶点活跃，set这里或，get的时候与
-		__sync_fetch_and_or(data+WORD_OFFSET(i), 1ul<<BIT_OFFSET(i));//先获取后或运算
+		if (__sync_fetch_and_or(data+WORD_OFFSET(i), 1ul<<BIT_OFFSET(i))==0) {//先获取后或运算
+			mark_word(WORD_OFFSET(i));
+		}
+	}
+	void clear_bit(size_t i) {
+		unsigned long mask = ~(1ul<<BIT_OFFSET(i));
+		if ((__sync_fetch_and_and(data+WORD_OFFSET(i), mask) & mask)==0) {
+			unmark_word(WORD_OFFSET(i));
+		}
+	}
+	// word w just became non-zero
+	void mark_word(size_t w) {
+		if (__sync_fetch_and_or(word_summary + (w >> 6), 1ul << (w & 63))==0) {
+			__sync_fetch_and_or(group_summary + (w >> 12), 1ul << ((w >> 6) & 63));
+		}
+	}
+	// the set bits in increasing order, if they are also kept as a list (see VertexSubset); NULL
+	// means the words have to be scanned
+	virtual const std::vector<VertexId> * sparse_vertices() {
+		return NULL;
 	}
 };
 
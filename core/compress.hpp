@@ -0,0 +1,200 @@
+/*
+Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <string.h>
+
+#include "core/type.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COMPRESS_SSSE3 1
+#endif
+
+// A compressed block is a sequence of frames of up to FRAME_EDGES edges sorted by (source, target).
+// Each frame is a FrameHeader followed by 2 * edges Stream VByte coded integers (control bytes,
+// then data bytes) and the raw payloads (weights, timestamps or labels) of the edges, if any. For every edge the integers are the
+// source delta from the previous source (the first one from source_base) and the target, which is
+// a delta from the previous target while the source repeats and relative to target_base otherwise.
+// Frames are padded to FRAME_ALIGN bytes so that every frame can be read with O_DIRECT.
+
+#define FRAME_EDGES 65536
+#define FRAME_ALIGN 4096
+
+struct FrameHeader {
+	unsigned int edges;
+	unsigned int bytes; // header included, padding excluded
+	VertexId source_base;
+	VertexId target_base;
+};
+
+inline long frame_padded_bytes(long bytes) {
+	return (bytes + FRAME_ALIGN - 1) / FRAME_ALIGN * FRAME_ALIGN;
+}
+
+// upper bound of the padded size of a frame holding edges edges of payload_bytes payload each
+inline long frame_max_bytes(long edges, int payload_bytes) {
+	long values = edges * 2;
+	return frame_padded_bytes(sizeof(FrameHeader) + (values + 3) / 4 + values * 4 + edges * payload_bytes);
+}
+
+struct StreamVByteTables {
+	unsigned char length[256];
+	unsigned char shuffle[256][16];
+	StreamVByteTables() {
+		for (int c=0;c<256;c++) {
+			int pos = 0;
+			for (int k=0;k<4;k++) {
+				int len = ((c >> (2 * k)) & 3) + 1;
+				for (int b=0;b<4;b++) {
+					shuffle[c][k * 4 + b] = (b < len) ? pos + b : 0x80;
+				}
+				pos += len;
+			}
+			length[c] = pos;
+		}
+	}
+};
+
+inline const StreamVByteTables & svb_tables() {
+	static StreamVByteTables tables;
+	return tables;
+}
+
+inline int svb_value_length(unsigned int v) {
+	if (v < (1u << 8)) return 1;
+	if (v < (1u << 16)) return 2;
+	if (v < (1u << 24)) return 3;
+	return 4;
+}
+
+// decodes values [done, count) with scalar code; data points to the bytes of value done
+inline void svb_decode_scalar(const unsigned char * control, const unsigned char * data, unsigned int * out, long done, long count) {
+	for (long k=done;k<count;k++) {
+		int len = ((control[k >> 2] >> (2 * (k & 3))) & 3) + 1;
+		unsigned int v = 0;
+		for (int b=0;b<len;b++) {
+			v |= (unsigned int)data[b] << (8 * b);
+		}
+		data += len;
+		out[k] = v;
+	}
+}
+
+#ifdef COMPRESS_SSSE3
+// one pshufb per group of four values while at least 16 data bytes are left; returns values decoded
+__attribute__((target("ssse3")))
+inline long svb_decode_ssse3(const unsigned char * control, const unsigned char * & data, const unsigned char * data_end, unsigned int * out, long count) {
+	const StreamVByteTables & tables = svb_tables();
+	long k = 0;
+	while (k + 4 <= count && data_end - data >= 16) {
+		unsigned char c = control[k >> 2];
+		__m128i bytes = _mm_loadu_si128((const __m128i *)data);
+		__m128i mask = _mm_loadu_si128((const __m128i *)tables.shuffle[c]);
+		_mm_storeu_si128((__m128i *)(out + k), _mm_shuffle_epi8(bytes, mask));
+		data += tables.length[c];
+		k += 4;
+	}
+	return k;
+}
+
+inline bool svb_has_ssse3() {
+	static bool supported = __builtin_cpu_supports("ssse3");
+	return supported;
+}
+#endif
+
+inline void svb_decode(const unsigned char * control, const unsigned char * data, const unsigned char * data_end, unsigned int * out, long count) {
+	long done = 0;
+#ifdef COMPRESS_SSSE3
+	if (svb_has_ssse3()) {
+		done = svb_decode_ssse3(control, data, data_end, out, count);
+	}
+#endif
+	svb_decode_scalar(control, data, out, done, count);
+}
+
+// encodes count records (already sorted) laid out stride bytes apart, each a source, a target and
+// payload_bytes of payload, into out, which must hold frame_max_bytes(count, payload_bytes);
+// returns the padded frame size
+inline long encode_frame(const char * records, long stride, long count, int payload_bytes, VertexId source_base, VertexId target_base, char * out) {
+	FrameHeader * header = (FrameHeader *)out;
+	header->edges = count;
+	header->source_base = source_base;
+	header->target_base = target_base;
+	long values = count * 2;
+	unsigned char * control = (unsigned char *)(out + sizeof(FrameHeader));
+	unsigned char * data = control + (values + 3) / 4;
+	memset(control, 0, (values + 3) / 4);
+	VertexId source = source_base;
+	VertexId target = target_base;
+	long k = 0;
+	for (long i=0;i<count;i++) {
+		VertexId edge_source = *(const VertexId *)(records + i * stride);
+		VertexId edge_target = *(const VertexId *)(records + i * stride + sizeof(VertexId));
+		unsigned int v[2];
+		v[0] = edge_source - source;
+		v[1] = edge_target - (v[0]==0 ? target : target_base);
+		source = edge_source;
+		target = edge_target;
+		for (int x=0;x<2;x++,k++) {
+			int len = svb_value_length(v[x]);
+			control[k >> 2] |= (len - 1) << (2 * (k & 3));
+			for (int b=0;b<len;b++) {
+				*data++ = (v[x] >> (8 * b)) & 0xff;
+			}
+		}
+	}
+	char * tail = (char *)data;
+	for (long i=0;i<count && payload_bytes>0;i++) {
+		memcpy(tail, records + i * stride + sizeof(VertexId) * 2, payload_bytes);
+		tail += payload_bytes;
+	}
+	header->bytes = tail - out;
+	long padded = frame_padded_bytes(header->bytes);
+	memset(tail, 0, padded - header->bytes);
+	return padded;
+}
+
+// decodes a frame into records of edge_unit bytes (source, target and edge_unit - 8 bytes of payload),
+// using scratch (2 * FRAME_EDGES integers); returns the number of edges
+inline long decode_frame(const char * frame, int edge_unit, unsigned int * scratch, char * out) {
+	const FrameHeader * header = (const FrameHeader *)frame;
+	long count = header->edges;
+	long values = count * 2;
+	int payload_bytes = edge_unit - sizeof(VertexId) * 2;
+	const unsigned char * control = (const unsigned char *)(frame + sizeof(FrameHeader));
+	const unsigned char * data = control + (values + 3) / 4;
+	const char * payloads = frame + header->bytes - count * payload_bytes;
+	svb_decode(control, data, (const unsigned char *)payloads, scratch, values);
+	VertexId source = header->source_base;
+	VertexId target = header->target_base;
+	for (long i=0;i<count;i++) {
+		unsigned int ds = scratch[i * 2];
+		source += ds;
+		target = (ds==0 ? target : header->target_base) + scratch[i * 2 + 1];
+		*(VertexId *)(out + i * edge_unit) = source;
+		*(VertexId *)(out + i * edge_unit + sizeof(VertexId)) = target;
+	}
+	for (long i=0;i<count && payload_bytes>0;i++) {
+		memcpy(out + i * edge_unit + sizeof(VertexId) * 2, payloads + i * payload_bytes, payload_bytes);
+	}
+	return count;
+}
+
+#endif
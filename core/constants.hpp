@@ -21,4 +21,39 @@ Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
 // #define PAGESIZE 4096
 #define IOSIZE 1048576 * 24
 
+#define IO_ENGINE_PREAD 0
+#define IO_ENGINE_URING 1
+#define URING_DEPTH 64
+#define URING_IOSIZE (1048576 * 3)
+
+#define PLACEMENT_FIRST_TOUCH 0
+#define PLACEMENT_INTERLEAVE 1
+#define PLACEMENT_BLOCKED 2
+
+#define HUGE_PAGES_NONE 0
+#define HUGE_PAGES_THP 1
+#define HUGE_PAGES_2MB 2
+#define HUGE_PAGES_1GB 3
+
+#define WINDOW_READ_WRITE 0
+#define WINDOW_READ_ONLY 1
+#define WINDOW_WRITE_ONLY 2
+#define WINDOW_MARKED 3
+
+#define INDEX_PAGES 16
+#define INDEX_THRESHOLD 0.05
+
+#define SPARSE_THRESHOLD 0.01
+
+#define PULL_ALPHA 14
+#define PULL_BETA 24
+
+#define QUEUE_SPINS 1024
+
+#define BATCH_EDGES 1024
+
+#define L2_CACHE_BYTES 1048576
+#define LLC_CACHE_BYTES (1048576 * 8)
+#define MIN_BLOCK_BYTES 1048576
+
 #endif
@@ -0,0 +1,166 @@
+/*
+Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <string.h>
+
+#include "core/type.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FILTER_SIMD 1
+#endif
+
+// Edge filtering for the batched scans: the records (source, target, payload; stride bytes apart)
+// whose source is in [begin_source, end_source), whose target is in [begin_target, end_target)
+// and whose source bit is set in bitmap (unless bitmap is NULL) are copied to out back to back.
+// The AVX-512 and AVX2 versions test 16 or 8 records at a time with gathers (the sources, the
+// targets and the 32-bit bitmap words holding the sources) and compares; the scalar version
+// handles the tail and CPUs without them.
+
+struct EdgeFilter {
+	VertexId begin_source;
+	VertexId end_source;
+	VertexId begin_target;
+	VertexId end_target;
+	const unsigned long * bitmap;
+};
+
+inline bool filter_edge(const EdgeFilter & filter, const char * record) {
+	VertexId source = *(const VertexId *)record;
+	VertexId target = *(const VertexId *)(record + sizeof(VertexId));
+	if (source < filter.begin_source || source >= filter.end_source) return false;
+	if (target < filter.begin_target || target >= filter.end_target) return false;
+	return filter.bitmap==NULL || (filter.bitmap[source >> 6] & (1ul << (source & 63)));
+}
+
+// filters count records; returns the number of records written to out
+inline long filter_edges_scalar(const char * records, long count, int stride, const EdgeFilter & filter, char * out) {
+	long passed = 0;
+	for (long k=0;k<count;k++) {
+		if (filter_edge(filter, records + k * stride)) {
+			memcpy(out + passed * stride, records + k * stride, stride);
+			passed++;
+		}
+	}
+	return passed;
+}
+
+#ifdef FILTER_SIMD
+__attribute__((target("avx2")))
+inline long filter_edges_avx2(const char * records, long count, int stride, const EdgeFilter & filter, char * out, long & passed) {
+	const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride / 4));
+	const __m256i begin_source = _mm256_set1_epi32(filter.begin_source - 1);
+	const __m256i end_source = _mm256_set1_epi32(filter.end_source);
+	const __m256i begin_target = _mm256_set1_epi32(filter.begin_target - 1);
+	const __m256i end_target = _mm256_set1_epi32(filter.end_target);
+	const __m256i bit_mask = _mm256_set1_epi32(31);
+	const __m256i one = _mm256_set1_epi32(1);
+	long k = 0;
+	for (;k+8<=count;k+=8) {
+		const char * group = records + k * stride;
+		__m256i source = _mm256_i32gather_epi32((const int *)group, index, 4);
+		__m256i target = _mm256_i32gather_epi32((const int *)(group + sizeof(VertexId)), index, 4);
+		__m256i pass = _mm256_and_si256(_mm256_cmpgt_epi32(source, begin_source), _mm256_cmpgt_epi32(end_source, source));
+		pass = _mm256_and_si256(pass, _mm256_and_si256(_mm256_cmpgt_epi32(target, begin_target), _mm256_cmpgt_epi32(end_target, target)));
+		if (filter.bitmap!=NULL) {
+			__m256i words = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)filter.bitmap, _mm256_srli_epi32(source, 5), pass, 4);
+			__m256i bits = _mm256_sllv_epi32(one, _mm256_and_si256(source, bit_mask));
+			pass = _mm256_and_si256(pass, _mm256_cmpeq_epi32(_mm256_and_si256(words, bits), bits));
+		}
+		unsigned int mask = _mm256_movemask_ps(_mm256_castsi256_ps(pass));
+		if (mask==0xff) {
+			memcpy(out + passed * stride, group, 8 * stride);
+			passed += 8;
+			continue;
+		}
+		while (mask!=0) {
+			int lane = __builtin_ctz(mask);
+			memcpy(out + passed * stride, group + lane * stride, stride);
+			passed++;
+			mask &= mask - 1;
+		}
+	}
+	return k;
+}
+
+__attribute__((target("avx512f")))
+inline long filter_edges_avx512(const char * records, long count, int stride, const EdgeFilter & filter, char * out, long & passed) {
+	const __m512i index = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(stride / 4));
+	const __m512i begin_source = _mm512_set1_epi32(filter.begin_source);
+	const __m512i end_source = _mm512_set1_epi32(filter.end_source);
+	const __m512i begin_target = _mm512_set1_epi32(filter.begin_target);
+	const __m512i end_target = _mm512_set1_epi32(filter.end_target);
+	const __m512i bit_mask = _mm512_set1_epi32(31);
+	const __m512i one = _mm512_set1_epi32(1);
+	long k = 0;
+	for (;k+16<=count;k+=16) {
+		const char * group = records + k * stride;
+		__m512i source = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), 0xffff, index, group, 4);
+		__m512i target = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), 0xffff, index, group + sizeof(VertexId), 4);
+		__mmask16 pass = _mm512_cmpge_epi32_mask(source, begin_source) & _mm512_cmplt_epi32_mask(source, end_source);
+		pass &= _mm512_cmpge_epi32_mask(target, begin_target) & _mm512_cmplt_epi32_mask(target, end_target);
+		if (filter.bitmap!=NULL && pass!=0) {
+			__m512i words = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), pass, _mm512_maskz_srli_epi32(pass, source, 5), filter.bitmap, 4);
+			__m512i bits = _mm512_maskz_sllv_epi32(pass, one, _mm512_and_si512(source, bit_mask));
+			pass &= _mm512_test_epi32_mask(words, bits);
+		}
+		if (pass==0xffff) {
+			memcpy(out + passed * stride, group, 16 * stride);
+			passed += 16;
+			continue;
+		}
+		if (stride==8) {
+			// unweighted records are 64-bit lanes: compress them straight into out
+			_mm512_mask_compressstoreu_epi64(out + passed * 8, (__mmask8)(pass & 0xff), _mm512_loadu_si512(group));
+			passed += __builtin_popcount(pass & 0xff);
+			_mm512_mask_compressstoreu_epi64(out + passed * 8, (__mmask8)(pass >> 8), _mm512_loadu_si512(group + 64));
+			passed += __builtin_popcount(pass >> 8);
+			continue;
+		}
+		unsigned int mask = pass;
+		while (mask!=0) {
+			int lane = __builtin_ctz(mask);
+			memcpy(out + passed * stride, group + lane * stride, stride);
+			passed++;
+			mask &= mask - 1;
+		}
+	}
+	return k;
+}
+
+inline int filter_simd_level() {
+	static int level = __builtin_cpu_supports("avx512f") ? 2 : (__builtin_cpu_supports("avx2") ? 1 : 0);
+	return level;
+}
+#endif
+
+inline long filter_edges(const char * records, long count, int stride, const EdgeFilter & filter, char * out) {
+	long passed = 0;
+	long done = 0;
+#ifdef FILTER_SIMD
+	if (filter_simd_level()==2) {
+		done = filter_edges_avx512(records, count, stride, filter, out, passed);
+	} else if (filter_simd_level()==1) {
+		done = filter_edges_avx2(records, count, stride, filter, out, passed);
+	}
+#endif
+	return passed + filter_edges_scalar(records + done * stride, count - done, stride, filter, out + passed * stride);
+}
+
+#endif
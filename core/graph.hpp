@@ -26,16 +26,25 @@ Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
 #include <string.h>
 
 #include <thread>
+#include <mutex>
 #include <vector>
+#include <functional>
+#include <algorithm>
 
 #include "core/constants.hpp"
 #include "core/type.hpp"
 #include "core/bitmap.hpp"
+#include "core/subset.hpp"
 #include "core/atomic.hpp"
 #include "core/queue.hpp"
 #include "core/partition.hpp"
 #include "core/bigvector.hpp"
 #include "core/time.hpp"
+#include "core/uring.hpp"
+#include "core/compress.hpp"
+#include "core/filter.hpp"
+#include "core/numa.hpp"
+#include "core/arena.hpp"
 
 bool f_true(VertexId v) {
 	return true;
@@ -55,16 +64,45 @@ class Graph {
 	bool * should_access_shard;
 	long ** fsize;
 	char ** buffer_pool;
+	int buffer_pool_size;
+	int io_threads;
+	int io_buffers;
 	long * column_offset;
 	long * row_offset;
+	long fsize_total;
 	long memory_bytes;
-	int partition_batch;
+	std::vector<int> window_bounds; // the first partition of each vertex window, then partitions
 	long vertex_data_bytes;
 	long PAGESIZE;
+	int io_engine;
+	int io_depth;
+	long io_size;
+	char ** uring_buffers;
+	Uring uring;
+	bool compressed;
+	bool single_copy;
+	std::vector<VertexId> partition_bounds;
+	long * column_frame_offset;
+	long column_frames;
+	long * row_frame_offset;
+	long row_frames;
+	char ** decode_pool;
+	unsigned int ** scratch_pool;
+	long index_unit;
+	VertexId * column_index;
+	VertexId * row_index;
+	bool edge_cache;
+	bool memory_budget_set;
+	long cached_bytes;
+	std::vector<char *> cache_data;
+	std::vector<long> cache_bytes;
+	std::vector<long> cache_reserved;
+	std::vector<int> cache_order;
 public:
 	std::string path;
 
 	int edge_type;
+	int edge_format;
 	VertexId vertices;
 	EdgeId edges;
 	int partitions;
@@ -72,17 +110,109 @@ public:
 	Graph (std::string path) {
 		PAGESIZE = 4096;
 		parallelism = std::thread::hardware_concurrency();
-		buffer_pool = new char * [parallelism*1];
-		for (int i=0;i<parallelism*1;i++) {
-			buffer_pool[i] = (char *)memalign(PAGESIZE, IOSIZE);
-			assert(buffer_pool[i]!=NULL);//地址不能为空
-			memset(buffer_pool[i], 0, IOSIZE);//初始化buffer_pool
+		const char * workers = getenv("GRIDGRAPH_THREADS");
+		if (workers!=NULL && atoi(workers) > 0) {
+			parallelism = atoi(workers);
+			omp_set_num_threads(parallelism);
 		}
+		numa().threads = parallelism;
+		if (numa().pin) {
+			pin_threads();
+		}
+		buffer_pool_size = 0;
+		buffer_pool = NULL;
+		grow_buffer_pool(parallelism);
 		init(path);
+
+		io_engine = IO_ENGINE_PREAD;
+		io_depth = 0;
+		io_size = IOSIZE;
+		uring_buffers = NULL;
+		const char * engine = getenv("GRIDGRAPH_IO_ENGINE");
+		if (engine!=NULL && strcmp(engine, "uring")==0) {
+			set_io_engine(IO_ENGINE_URING);
+		}
+		io_threads = 0;
+		io_buffers = 0;
+		const char * threads = getenv("GRIDGRAPH_IO_THREADS");
+		if (threads!=NULL) {
+			set_io_threads(atoi(threads));
+		}
+	}
+
+	// pin the OpenMP workers, which persist across parallel regions, to CPUs of their nodes; the
+	// stream_edges workers pin themselves. The master thread is one of them, so helper threads it
+	// starts (I/O readers, BigVector writeback) inherit its single CPU and must unpin themselves.
+	void pin_threads() {
+		#pragma omp parallel num_threads(parallelism)
+		{
+			numa().pin_thread(omp_get_thread_num());
+		}
+	}
+
+	void grow_buffer_pool(int size) {
+		if (size <= buffer_pool_size) return;
+		char ** pool = new char * [size];
+		for (int i=0;i<size;i++) {
+			if (i < buffer_pool_size) {
+				pool[i] = buffer_pool[i];
+				continue;
+			}
+			pool[i] = arena().alloc(IOSIZE);
+			assert(pool[i]!=NULL);//地址不能为空
+			// slot i serves worker i (modulo the workers in the pipeline engine), so keep it on its node
+			if (numa().pin) {
+				numa().bind(pool[i], IOSIZE, numa().thread_node(i % parallelism));
+			}
+			memset(pool[i], 0, IOSIZE);//初始化buffer_pool
+		}
+		delete [] buffer_pool;
+		buffer_pool = pool;
+		buffer_pool_size = size;
+	}
+
+	// with io_threads > 0 the pread engine runs as a pipeline: io_threads readers fill a ring of
+	// buffers (parallelism + io_threads by default) that the compute threads drain, so disk reads
+	// overlap with edge processing; io_threads = 0 keeps one blocking read per compute thread. The
+	// ring uses exactly that many buffers of the pool, which may hold more for the other engines
+	void set_io_threads(int io_threads, int buffers = 0) {
+		this->io_threads = io_threads > 0 ? io_threads : 0;
+		if (this->io_threads==0) return;
+		if (buffers <= 0) {
+			buffers = parallelism + this->io_threads;
+		}
+		io_buffers = buffers;
+		grow_buffer_pool(buffers);
+	}
+
+	// select how stream_edges reads the grid: IO_ENGINE_PREAD (one blocking read per worker)
+	// or IO_ENGINE_URING (up to depth reads in flight); falls back to pread if io_uring is unavailable
+	void set_io_engine(int engine, int depth = URING_DEPTH) {
+		io_engine = IO_ENGINE_PREAD;
+		io_size = IOSIZE;
+		if (engine!=IO_ENGINE_URING) return;
+		if (!uring.is_open()) {
+			if (!uring.init(depth)) {
+				fprintf(stderr, "io_uring is not available, using pread instead\n");
+				return;
+			}
+			io_depth = depth;
+			uring_buffers = new char * [io_depth];
+			for (int i=0;i<io_depth;i++) {
+				uring_buffers[i] = arena().alloc(URING_IOSIZE);
+				assert(uring_buffers[i]!=NULL);
+				numa().place(uring_buffers[i], URING_IOSIZE, PLACEMENT_INTERLEAVE);
+				memset(uring_buffers[i], 0, URING_IOSIZE);
+			}
+			uring.register_buffers(uring_buffers, io_depth, URING_IOSIZE);
+		}
+		io_engine = IO_ENGINE_URING;
+		io_size = URING_IOSIZE;
 	}
 
 	void set_memory_bytes(long memory_bytes) {
 		this->memory_bytes = memory_bytes;
+		memory_budget_set = true;
 	}
 
 	void set_vertex_data_bytes(long vertex_data_bytes) {
@@ -94,127 +224,243 @@ public:
 
 		FILE * fin_meta = fopen((path+"/meta").c_str(), "r");
 		fscanf(fin_meta, "%d %d %ld %d", &edge_type, &vertices, &edges, &partitions);
+		compressed = false;
+		single_copy = false;
+		bool balanced = false;
+		index_unit = 0;
+		edge_format = (edge_type==0) ? EDGE_UNWEIGHTED : EDGE_FLOAT;
+		char key[64], value[64];
+		while (fscanf(fin_meta, "%63s %63s", key, value)==2) {
+			if (strcmp(key, "compressed")==0) {
+				compressed = (atol(value)!=0);
+			} else if (strcmp(key, "layout")==0) {
+				single_copy = (strcmp(value, "single")==0);
+			} else if (strcmp(key, "partition")==0) {
+				balanced = (strcmp(value, "uniform")!=0);
+			} else if (strcmp(key, "index_unit")==0) {
+				index_unit = atol(value);
+			} else if (strcmp(key, "format")==0) {
+				edge_format = parse_edge_format(value);
+				if (edge_format==-1) {
+					fprintf(stderr, "edge format (%s) is not supported.\n", value);
+					exit(-1);
+				}
+			}
+		}
 		fclose(fin_meta);
 
-		if (edge_type==0) {
-			PAGESIZE = 4096;
+		// partition boundaries, which balanced grids store in partition_bounds (partitions + 1 ids)
+		if (balanced) {
+			VertexId * bounds;
+			long count = load_array(path+"/partition_bounds", bounds);
+			assert(count==partitions+1);
+			partition_bounds.assign(bounds, bounds + count);
+			delete [] bounds;
 		} else {
-			PAGESIZE = 12288;
+			partition_bounds = uniform_partition_bounds(vertices, partitions);
 		}
 
 		should_access_shard = new bool[partitions];
 
-		if (edge_type==0) {
-			edge_unit = sizeof(VertexId) * 2;
-		} else {
-			edge_unit = sizeof(VertexId) * 2 + sizeof(Weight);
-		}
+		edge_unit = edge_format_unit(edge_format);
+		PAGESIZE = edge_page_size(edge_unit);
 
 		memory_bytes = 1024l*1024l*1024l*1024l; // assume RAM capacity is very large
-		partition_batch = partitions;
+		memory_budget_set = false;
+		window_bounds = {0, partitions};
 		vertex_data_bytes = 0;
 
-		char filename[1024];
+		long bytes;
+
+		row_offset = new long [partitions*partitions+1];
+		int fin_row_offset = open((path+"/row_offset").c_str(), O_RDONLY);
+		bytes = read(fin_row_offset, row_offset, sizeof(long)*(partitions*partitions+1));
+		assert(bytes==sizeof(long)*(partitions*partitions+1));
+		close(fin_row_offset);
+
+		// a single copy grid has only the row file, whose blocks start on pages: the column view
+		// points into it, and block_bytes holds the block sizes without the padding
+		long * block_bytes = NULL;
+		column_offset = new long [partitions*partitions+1];
+		if (single_copy) {
+			load_array(path+"/block_bytes", block_bytes);
+			for (int i=0;i<partitions;i++) {
+				for (int j=0;j<partitions;j++) {
+					column_offset[j*partitions+i] = row_offset[i*partitions+j];
+				}
+			}
+			column_offset[partitions*partitions] = row_offset[partitions*partitions];
+		} else {
+			int fin_column_offset = open((path+"/column_offset").c_str(), O_RDONLY);
+			bytes = read(fin_column_offset, column_offset, sizeof(long)*(partitions*partitions+1));
+			assert(bytes==sizeof(long)*(partitions*partitions+1));
+			close(fin_column_offset);
+		}
+
 		fsize = new long * [partitions];
 		for (int i=0;i<partitions;i++) {
 			fsize[i] = new long [partitions];
 			for (int j=0;j<partitions;j++) {
-				sprintf(filename, "%s/block-%d-%d", path.c_str(), i, j);
-				fsize[i][j] = file_size(filename);
+				if (single_copy) {
+					fsize[i][j] = block_bytes[i*partitions+j];
+				} else {
+					fsize[i][j] = row_offset[i*partitions+j+1] - row_offset[i*partitions+j];
+				}
 			}
 		}
+		delete [] block_bytes;
+		fsize_total = row_offset[partitions*partitions];
 
-		long bytes;
+		if (compressed) {
+			row_frames = load_array(path+"/row_frame_offset", row_frame_offset) - 1;
+			if (single_copy) {
+				column_frame_offset = row_frame_offset;
+				column_frames = row_frames;
+			} else {
+				column_frames = load_array(path+"/column_frame_offset", column_frame_offset) - 1;
+			}
+			decode_pool = new char * [parallelism];
+			scratch_pool = new unsigned int * [parallelism];
+			for (int i=0;i<parallelism;i++) {
+				decode_pool[i] = arena().alloc((long)FRAME_EDGES * edge_unit);
+				if (numa().pin) {
+					numa().bind(decode_pool[i], (long)FRAME_EDGES * edge_unit, numa().thread_node(i));
+				}
+				scratch_pool[i] = new unsigned int [FRAME_EDGES * 2];
+			}
+		}
 
-		column_offset = new long [partitions*partitions+1];
-		int fin_column_offset = open((path+"/column_offset").c_str(), O_RDONLY);
-		bytes = read(fin_column_offset, column_offset, sizeof(long)*(partitions*partitions+1));
-		assert(bytes==sizeof(long)*(partitions*partitions+1));
-		close(fin_column_offset);
+		if (index_unit > 0) {
+			load_array(path+"/row_index", row_index);
+			if (single_copy) {
+				column_index = row_index;
+			} else {
+				load_array(path+"/column_index", column_index);
+			}
+		}
 
-		row_offset = new long [partitions*partitions+1];
-		int fin_row_offset = open((path+"/row_offset").c_str(), O_RDONLY);
-		bytes = read(fin_row_offset, row_offset, sizeof(long)*(partitions*partitions+1));
-		assert(bytes==sizeof(long)*(partitions*partitions+1));
-		close(fin_row_offset);
+		edge_cache = true;
+		cached_bytes = 0;
+		cache_data.assign(partitions*partitions, NULL);
+		cache_bytes.assign(partitions*partitions, 0);
+		cache_reserved.assign(partitions*partitions, 0);
+		cache_order.clear();
+	}
+
+	// keep edge blocks in memory across calls, within the memory budget left by vertex data
+	void set_edge_cache(bool edge_cache) {
+		this->edge_cache = edge_cache;
+		update_edge_cache(false);
+	}
+
+	// read a whole file into a new array, returning the number of elements
+	template <typename A>
+	long load_array(std::string filename, A * & array) {
+		long bytes = file_size(filename);
+		array = new A [bytes / sizeof(A)];
+		int fin = open(filename.c_str(), O_RDONLY);
+		for (long offset=0;offset<bytes;) {
+			long read_bytes = read(fin, (char *)array + offset, bytes - offset);
+			assert(read_bytes>0);
+			offset += read_bytes;
+		}
+		close(fin);
+		return bytes / sizeof(A);
+	}
+
+	// the file holding the blocks in column order, or the single copy
+	std::string column_file() {
+		return path + (single_copy ? "/row" : "/column");
 	}
 
 	Bitmap * alloc_bitmap() {
 		return new Bitmap(vertices);
 	}
 
+	// a frontier that is kept as a sorted vertex list while sparse; see VertexSubset
+	VertexSubset * alloc_subset() {
+		return new VertexSubset(vertices, parallelism);
+	}
+
+	// compatibility entry point for std::function callbacks; lambdas bind to the template below,
+	// which lets the compiler inline process into the vertex loops
 	template <typename T>
 	T stream_vertices(std::function<T(VertexId)> process, Bitmap * bitmap = nullptr, T zero = 0,
 		std::function<void(std::pair<VertexId,VertexId>)> pre = f_none_1,
 		std::function<void(std::pair<VertexId,VertexId>)> post = f_none_1) {
-		T value = zero;
+		return stream_vertices<T, std::function<T(VertexId)> >(process, bitmap, zero, pre, post);
+	}
+
+	template <typename T, typename F>
+	T stream_vertices(F process, Bitmap * bitmap = nullptr, T zero = 0,
+		std::function<void(std::pair<VertexId,VertexId>)> pre = f_none_1,
+		std::function<void(std::pair<VertexId,VertexId>)> post = f_none_1) {
+		Reducer<T> local_values(parallelism, zero);
 		if (bitmap==nullptr && vertex_data_bytes > (0.8 * memory_bytes)) {//vertexid+float+float，附加数据很大时候，分区就得自动小
-			for (int cur_partition=0;cur_partition<partitions;cur_partition+=partition_batch) {
-				VertexId begin_vid, end_vid;
-				begin_vid = get_partition_range(vertices, partitions, cur_partition).first;
-				if (cur_partition+partition_batch>=partitions) {
-					end_vid = vertices;
-				} else {
-					end_vid = get_partition_range(vertices, partitions, cur_partition+partition_batch).first;
-				}
+			for (size_t window=0;window+1<window_bounds.size();window++) {
+				int cur_partition = window_bounds[window], end_partition = window_bounds[window+1];
+				VertexId begin_vid = partition_bounds[cur_partition], end_vid = partition_bounds[end_partition];
 				pre(std::make_pair(begin_vid, end_vid));
 				#pragma omp parallel for schedule(dynamic) num_threads(parallelism)//线程谁有空谁跑
-				for (int partition_id=cur_partition;partition_id<cur_partition+partition_batch;partition_id++) {
-					if (partition_id < partitions) {
-						T local_value = zero;
-						VertexId begin_vid, end_vid;
-						std::tie(begin_vid, end_vid) = get_partition_range(vertices, partitions, partition_id);
-						for (VertexId i=begin_vid;i<end_vid;i++) {
-							local_value += process(i);
-						}
-						write_add(&value, local_value);
+				for (int partition_id=cur_partition;partition_id<end_partition;partition_id++) {
+					T local_value = zero;
+					VertexId begin_vid, end_vid;
+					std::tie(begin_vid, end_vid) = get_partition_range(partition_bounds.data(), partitions, partition_id);
+					for (VertexId i=begin_vid;i<end_vid;i++) {
+						local_value += process(i);
 					}
+					local_values[omp_get_thread_num()] += local_value;
 				}
 				#pragma omp barrier
 				post(std::make_pair(begin_vid, end_vid));
 			}
+		} else if (bitmap!=nullptr && bitmap->sparse_vertices()!=NULL) {
+			const std::vector<VertexId> & active = *bitmap->sparse_vertices();
+			#pragma omp parallel for schedule(dynamic, 64) num_threads(parallelism)
+			for (size_t k=0;k<active.size();k++) {
+				local_values[omp_get_thread_num()] += process(active[k]);
+			}
 		} else {
 			#pragma omp parallel for schedule(dynamic) num_threads(parallelism)
 			for (int partition_id=0;partition_id<partitions;partition_id++) {
 				T local_value = zero;
 				VertexId begin_vid, end_vid;
-				std::tie(begin_vid, end_vid) = get_partition_range(vertices, partitions, partition_id);
+				std::tie(begin_vid, end_vid) = get_partition_range(partition_bounds.data(), partitions, partition_id);
 				if (bitmap==nullptr) {
 					for (VertexId i=begin_vid;i<end_vid;i++) {
 						local_value += process(i);
 					}
 				} else {
-					VertexId i = begin_vid;
-					while (i<end_vid) {
-						unsigned long word = bitmap->data[WORD_OFFSET(i)];
-						if (word==0) {
-							i = (WORD_OFFSET(i) + 1) << 6;
-							continue;
-						}
-						size_t j = BIT_OFFSET(i);
-						word = word >> j;
+					bitmap->for_each_word(begin_vid, end_vid, [&](size_t w, unsigned long word){
 						while (word!=0) {
-							if (word & 1) {
-								local_value += process(i);
-							}
-							i++;
-							j++;
-							word = word >> 1;
-							if (i==end_vid) break;
+							local_value += process((w << 6) + __builtin_ctzl(word));
+							word &= word - 1;
 						}
-						i += (64 - j);
-					}
+						return false;
+					});
 				}
-				write_add(&value, local_value);
+				local_values[omp_get_thread_num()] += local_value;
 			}
 			#pragma omp barrier
 		}
-		return value;
+		return local_values.sum(zero);
 	}
 
+	// split the partitions into vertex windows whose share of bytes (the vertex data of all vertices)
+	// fits in 0.8 * memory_bytes: a window grows partition by partition while its vertices fit, so
+	// windows of partitions with uneven sizes (balanced grids) stay within the budget too
 	void set_partition_batch(long bytes) {
-		int x = (int)ceil(bytes / (0.8 * memory_bytes));//ceil(x)返回的是大于x的最小整数。每个字节的数据
-		partition_batch = partitions / x;
+		double vertex_bytes = vertices > 0 ? (double)bytes / vertices : 0;//每个顶点的数据
+		double budget = 0.8 * memory_bytes;
+		window_bounds.assign(1, 0);
+		for (int partition_id=0;partition_id<partitions;partition_id++) {
+			VertexId begin_vid = partition_bounds[window_bounds.back()], end_vid = partition_bounds[partition_id+1];
+			// a single partition over the budget still makes a window of its own
+			if (partition_id > window_bounds.back() && (end_vid - begin_vid) * vertex_bytes > budget) {
+				window_bounds.push_back(partition_id);
+			}
+		}
+		window_bounds.push_back(partitions);
 	}
 
 	template <typename... Args>//一个函数形参包（function parameter pack）是一个接受零个或多个函数实参的函数形参
@@ -238,47 +484,711 @@ public:
 		set_partition_batch(bytes);
 	}
 
+	// bytes between records seen as E; a compile-time constant for the typed records
+	template <typename E>
+	long edge_stride() {
+		return EdgeFormatOf<E>::format==-1 ? edge_unit : (long)sizeof(E);
+	}
+
+	template <typename E>
+	void check_edge_format() {
+		if (EdgeFormatOf<E>::format!=-1 && EdgeFormatOf<E>::format!=edge_format) {
+			fprintf(stderr, "edges of format %s cannot be streamed as %s records\n", edge_format_name(edge_format), edge_format_name(EdgeFormatOf<E>::format));
+			exit(-1);
+		}
+	}
+
+	// split the edges in [begin_offset, end_offset) into page aligned reads of at most io_size bytes;
+	// offset is where the previous read stopped, so a page shared by two blocks is read only once
+	void split_chunks(long begin_offset, long end_offset, long & offset, std::vector<std::pair<long,long> > & chunks) {
+		// blocks of a single copy grid may be visited backwards
+		if (begin_offset - offset >= PAGESIZE || begin_offset < offset - PAGESIZE) {
+			offset = begin_offset / PAGESIZE * PAGESIZE;
+		}
+		if (end_offset <= offset) return;
+		while (end_offset - offset >= io_size) {
+			chunks.push_back(std::make_pair(offset, io_size));//24M按IOSIZE一页一页传
+			offset += io_size;
+		}
+		if (end_offset > offset) {
+			long length = (end_offset - offset + PAGESIZE - 1) / PAGESIZE * PAGESIZE;//不能落下余数
+			chunks.push_back(std::make_pair(offset, length));
+			offset += length;
+		}
+	}
+
+	// group the frames starting in [begin_offset, end_offset) of a compressed grid into reads of
+	// at most io_size bytes, extending the previous read when it ends where the next frame begins
+	void split_frames(long begin_offset, long end_offset, long * frame_offset, long frames, std::vector<std::pair<long,long> > & chunks) {
+		long f = std::lower_bound(frame_offset, frame_offset + frames, begin_offset) - frame_offset;
+		for (;f<frames && frame_offset[f]<end_offset;f++) {
+			long length = frame_offset[f+1] - frame_offset[f];
+			if (!chunks.empty() && chunks.back().first + chunks.back().second==frame_offset[f] && chunks.back().second + length <= io_size) {
+				chunks.back().second += length;
+			} else {
+				chunks.push_back(std::make_pair(frame_offset[f], length));
+			}
+		}
+	}
+
+	// merge reads that continue one another into reads of up to io_size bytes: runs of raw edges are
+	// cut again at io_size, while frames are only ever appended whole
+	void coalesce_chunks(std::vector<std::pair<long,long> > & chunks) {
+		std::vector<std::pair<long,long> > merged;
+		for (size_t c=0;c<chunks.size();c++) {
+			long begin = chunks[c].first;
+			long length = chunks[c].second;
+			while (length > 0) {
+				long take = length;
+				if (!merged.empty() && merged.back().first + merged.back().second==begin && merged.back().second + (compressed ? length : PAGESIZE) <= io_size) {
+					take = std::min(length, io_size - merged.back().second);
+					merged.back().second += take;
+				} else {
+					if (!compressed) take = std::min(length, io_size);
+					merged.push_back(std::make_pair(begin, take));
+				}
+				begin += take;
+				length -= take;
+			}
+		}
+		chunks.swap(merged);
+	}
+
+	// keep only the index units of the chunks (frames on compressed grids) whose source range
+	// [index[2u], index[2u+1]] contains an active vertex
+	void select_chunks(std::vector<std::pair<long,long> > & chunks, VertexId * index, long * frame_offset, long frames, Bitmap * bitmap) {
+		std::vector<std::pair<long,long> > selected;
+		auto select = [&](long begin, long end) {
+			if (!selected.empty() && selected.back().first + selected.back().second==begin && selected.back().second + end - begin <= io_size) {
+				selected.back().second += end - begin;
+			} else {
+				selected.push_back(std::make_pair(begin, end - begin));
+			}
+		};
+		for (size_t c=0;c<chunks.size();c++) {
+			long begin = chunks[c].first;
+			long end = chunks[c].first + chunks[c].second;
+			if (compressed) {
+				long f = std::lower_bound(frame_offset, frame_offset + frames, begin) - frame_offset;
+				for (;f<frames && frame_offset[f]<end;f++) {
+					if (bitmap->any(index[f*2], index[f*2+1] + 1)) {
+						select(frame_offset[f], frame_offset[f+1]);
+					}
+				}
+			} else {
+				long units = (fsize_total + index_unit - 1) / index_unit;
+				for (long u=begin/index_unit;u<units && u*index_unit<end;u++) {
+					if (index[u*2]!=-1 && bitmap->any(index[u*2], index[u*2+1] + 1)) {
+						select(std::max(begin, u*index_unit), std::min(end, (u+1)*index_unit));
+					}
+				}
+			}
+		}
+		chunks.swap(selected);
+	}
+
+	// Edge blocks (decoded on compressed grids) are cached in memory across calls, within what is
+	// left of 0.8 * memory_bytes after vertex data and I/O buffers. A block is admitted the first time
+	// a full pass touches it, if it fits, and then stays until the budget shrinks: repeated scans keep
+	// hitting the same fixed set of blocks instead of evicting each other as an LRU cache would.
+	// Nothing is cached until set_memory_bytes gives an explicit budget.
+	long edge_cache_budget() {
+		if (!edge_cache || !memory_budget_set) return 0;
+		long budget = (long)(0.8 * memory_bytes) - vertex_data_bytes - arena().bytes();
+		return budget > 0 ? budget : 0;
+	}
+
+	// memory taken by a cached block; an upper bound for compressed grids
+	long cached_block_bytes(int i, int j) {
+		if (!compressed) return fsize[i][j];
+		long begin_frame = std::lower_bound(row_frame_offset, row_frame_offset + row_frames, row_offset[i*partitions+j]) - row_frame_offset;
+		long end_frame = std::lower_bound(row_frame_offset, row_frame_offset + row_frames, row_offset[i*partitions+j] + fsize[i][j]) - row_frame_offset;
+		return (end_frame - begin_frame) * FRAME_EDGES * edge_unit;
+	}
+
+	void load_cached_block(int fin, int block) {
+		long begin_offset = row_offset[block];
+		long bytes = fsize[block / partitions][block % partitions];
+		char * data = (char *)memalign(4096, compressed ? bytes : cache_reserved[block]);
+		assert(data!=NULL);
+		for (long offset=0;offset<bytes;) {
+			long read_bytes = pread(fin, data + offset, bytes - offset, begin_offset + offset);
+			assert(read_bytes>0);
+			offset += read_bytes;
+		}
+		if (!compressed) {
+			cache_data[block] = data;
+			cache_bytes[block] = bytes;
+			return;
+		}
+		char * edges = (char *)memalign(4096, cache_reserved[block]);
+		assert(edges!=NULL);
+		unsigned int * scratch = new unsigned int [FRAME_EDGES * 2];
+		long decoded_bytes = 0;
+		for (long pos=0;pos<bytes;) {
+			FrameHeader * header = (FrameHeader *)(data + pos);
+			decoded_bytes += decode_frame(data + pos, edge_unit, scratch, edges + decoded_bytes) * edge_unit;
+			pos += frame_padded_bytes(header->bytes);
+		}
+		delete [] scratch;
+		free(data);
+		cache_data[block] = edges;
+		cache_bytes[block] = decoded_bytes;
+	}
+
+	// evict blocks if the budget shrank, then admit the uncached blocks of the rows in
+	// should_access_shard (and the columns in should_access_column, if given) that still fit
+	void update_edge_cache(bool admit, std::vector<bool> * should_access_column = nullptr) {
+		long budget = edge_cache_budget();
+		while (cached_bytes > budget) {
+			int block = cache_order.back();
+			cache_order.pop_back();
+			cached_bytes -= cache_reserved[block];
+			free(cache_data[block]);
+			cache_data[block] = NULL;
+			cache_bytes[block] = 0;
+		}
+		if (!admit) return;
+		std::vector<int> blocks;
+		for (int i=0;i<partitions;i++) {
+			if (!should_access_shard[i]) continue;
+			for (int j=0;j<partitions;j++) {
+				if (should_access_column!=nullptr && !(*should_access_column)[j]) continue;
+				int block = i*partitions+j;
+				if (cache_data[block]!=NULL || fsize[i][j]==0) continue;
+				long bytes = cached_block_bytes(i, j);
+				if (cached_bytes + bytes > budget) continue;
+				cached_bytes += bytes;
+				cache_reserved[block] = bytes;
+				blocks.push_back(block);
+			}
+		}
+		if (blocks.empty()) return;
+		int fin = open((path+"/row").c_str(), O_RDONLY);
+		#pragma omp parallel for schedule(dynamic) num_threads(parallelism)
+		for (size_t k=0;k<blocks.size();k++) {
+			load_cached_block(fin, blocks[k]);
+		}
+		close(fin);
+		cache_order.insert(cache_order.end(), blocks.begin(), blocks.end());
+	}
+
+	// scan the cached blocks on the worker threads, IOSIZE bytes at a time
 	template <typename T>
-	T stream_edges(std::function<T(Edge&)> process, Bitmap * bitmap = nullptr, T zero = 0, int update_mode = 1,
-		std::function<void(std::pair<VertexId,VertexId> vid_range)> pre_source_window = f_none_1,
-		std::function<void(std::pair<VertexId,VertexId> vid_range)> post_source_window = f_none_1,
-		std::function<void(std::pair<VertexId,VertexId> vid_range)> pre_target_window = f_none_1,
-		std::function<void(std::pair<VertexId,VertexId> vid_range)> post_target_window = f_none_1) {
-		if (bitmap==nullptr) {
-			for (int i=0;i<partitions;i++) {
-				should_access_shard[i] = true;
+	void scan_cached_blocks(std::vector<int> & blocks, std::function<T(char *, long, long)> & scan, Reducer<T> & local_values) {
+		std::vector<std::pair<char *, long> > pieces;
+		for (size_t k=0;k<blocks.size();k++) {
+			for (long pos=0;pos<cache_bytes[blocks[k]];pos+=IOSIZE) {
+				pieces.push_back(std::make_pair(cache_data[blocks[k]] + pos, std::min((long)IOSIZE, cache_bytes[blocks[k]] - pos)));
 			}
-		} else {
-			for (int i=0;i<partitions;i++) {
-				should_access_shard[i] = false;
+		}
+		#pragma omp parallel for schedule(dynamic) num_threads(parallelism)
+		for (size_t k=0;k<pieces.size();k++) {
+			local_values[omp_get_thread_num()] += scan(pieces[k].first, 0, pieces[k].second);
+		}
+	}
+
+	// run scan(edges, begin, bytes) over the edges read into buffer, decoding them frame by frame
+	// into the thread's decode buffer first if the grid is compressed
+	// if blocks are cached, the bytes of those blocks read along with a neighbouring block are skipped,
+	// and so is the padding between the blocks of a single copy grid;
+	// offsets are the block offsets of the file (row_offset or column_offset)
+	template <typename T>
+	T scan_chunk(int thread_id, char * buffer, long offset, long bytes, T zero, std::function<T(char *, long, long)> & scan, long * offsets, bool column_order) {
+		if (single_copy) {
+			offsets = row_offset;
+			column_order = false;
+		}
+		if (!compressed && cache_order.empty() && !single_copy) {
+			// CHECK: start position should be offset % edge_unit
+			return scan(buffer, offset % edge_unit, bytes);
+		}
+		if (!compressed) {
+			T value = zero;
+			long k = std::upper_bound(offsets, offsets + partitions*partitions + 1, offset) - offsets - 1;
+			for (;k<partitions*partitions && offsets[k]<offset+bytes;k++) {
+				int block = column_order ? (k % partitions) * partitions + k / partitions : k;
+				if (cache_data[block]!=NULL) continue;
+				long begin = offsets[k] > offset ? offsets[k] - offset : offset % edge_unit;
+				long end = std::min(offsets[k] + fsize[block / partitions][block % partitions], offset + bytes) - offset;
+				if (end > begin) value += scan(buffer, begin, end);
 			}
+			return value;
+		}
+		T value = zero;
+		for (long pos=0;pos+(long)sizeof(FrameHeader)<=bytes;) {
+			FrameHeader * header = (FrameHeader *)(buffer + pos);
+			if (header->edges==0) break;
+			long count = decode_frame(buffer + pos, edge_unit, scratch_pool[thread_id], decode_pool[thread_id]);
+			value += scan(decode_pool[thread_id], 0, count * edge_unit);
+			pos += frame_padded_bytes(header->bytes);
+		}
+		return value;
+	}
+
+	// read the chunks of fin with the selected engine and call consume(thread_id, buffer, offset, bytes)
+	// for each of them on one of the worker threads; returns the number of bytes read
+	long read_chunks(int fin, std::vector<std::pair<long,long> > & chunks, std::function<void(int, char *, long, long)> consume) {
+		if (io_engine==IO_ENGINE_URING) {
+			return uring_read_chunks(fin, chunks, consume);
+		}
+		if (io_threads > 0) {
+			return pipeline_read_chunks(fin, chunks, consume);
+		}
+		return pread_read_chunks(fin, chunks, consume);
+	}
+
+	long pread_read_chunks(int fin, std::vector<std::pair<long,long> > & chunks, std::function<void(int, char *, long, long)> consume) {
+		Queue<std::pair<long, long> > tasks(65536);//2^16
+		std::vector<std::thread> threads;
+		long read_bytes = 0;
+		for (int ti=0;ti<parallelism;ti++) {
+			threads.emplace_back([&](int thread_id){
+				if (numa().pin) numa().pin_thread(thread_id);
+				streaming_worker() = thread_id;
+				long local_read_bytes = 0;
+				while (true) {
+					long offset, length;
+					std::tie(offset, length) = tasks.pop();
+					if (offset==-1) break;
+					char * buffer = buffer_pool[thread_id];
+					//ssize_t  pread (int filedes,   void *buf,  size_t  nbytes,  off_t  offset );
+					//成功：返回读到的字节数；出错：返回-1；到文件结尾：返回0
+					long bytes = pread(fin, buffer, length, offset);//pread()是可以在多线程下使用的
+					assert(bytes>0);
+					local_read_bytes += bytes;
+					consume(thread_id, buffer, offset, bytes);
+				}
+				write_add(&read_bytes, local_read_bytes);
+			}, ti);//ti是参数
+		}
+		for (size_t i=0;i<chunks.size();i++) {
+			tasks.push(chunks[i]);
+		}
+		for (int i=0;i<parallelism;i++) {
+			tasks.push(std::make_pair(-1l, 0l));
+		}
+		for (int i=0;i<parallelism;i++) {
+			threads[i].join();
+		}
+		return read_bytes;
+	}
+
+	// io_threads readers take chunks in order and fill free buffers of the pool, blocking while
+	// every buffer is waiting to be scanned; the compute threads return buffers once they are done
+	long pipeline_read_chunks(int fin, std::vector<std::pair<long,long> > & chunks, std::function<void(int, char *, long, long)> consume) {
+		Queue<int> free_slots(io_buffers);
+		Queue<std::tuple<int, long, long> > ready(io_buffers + parallelism);
+		for (int i=0;i<io_buffers;i++) {
+			free_slots.push(i);
+		}
+		long next_chunk = 0;
+		long read_bytes = 0;
+		std::vector<std::thread> readers;
+		for (int ti=0;ti<io_threads;ti++) {
+			readers.emplace_back([&](){
+				if (numa().pin) numa().unpin_thread();
+				long local_read_bytes = 0;
+				while (true) {
+					long i = __sync_fetch_and_add(&next_chunk, 1);
+					if (i >= (long)chunks.size()) break;
+					int slot = free_slots.pop();
+					long bytes = pread(fin, buffer_pool[slot], chunks[i].second, chunks[i].first);
+					assert(bytes>0);
+					local_read_bytes += bytes;
+					ready.push(std::make_tuple(slot, chunks[i].first, bytes));
+				}
+				write_add(&read_bytes, local_read_bytes);
+			});
+		}
+		std::vector<std::thread> threads;
+		for (int ti=0;ti<parallelism;ti++) {
+			threads.emplace_back([&](int thread_id){
+				if (numa().pin) numa().pin_thread(thread_id);
+				streaming_worker() = thread_id;
+				while (true) {
+					int slot;
+					long offset, bytes;
+					std::tie(slot, offset, bytes) = ready.pop();
+					if (slot==-1) break;
+					consume(thread_id, buffer_pool[slot], offset, bytes);
+					free_slots.push(slot);
+				}
+			}, ti);
+		}
+		for (int i=0;i<io_threads;i++) {
+			readers[i].join();
+		}
+		for (int i=0;i<parallelism;i++) {
+			ready.push(std::make_tuple(-1, 0l, 0l));
+		}
+		for (int i=0;i<parallelism;i++) {
+			threads[i].join();
+		}
+		return read_bytes;
+	}
+
+	// like pread_read_chunks, but every group of chunks is read and consumed by a single thread,
+	// so consume(thread_id, group, buffer, offset, bytes) never runs concurrently for one group;
+	// the same thread then calls resident(thread_id, group) for the group's in-memory edges
+	long read_chunk_groups(int fin, std::vector<std::vector<std::pair<long,long> > > & groups, std::function<void(int, int, char *, long, long)> consume, std::function<void(int, int)> resident) {
+		std::vector<std::thread> threads;
+		long next_group = 0;
+		long read_bytes = 0;
+		for (int ti=0;ti<parallelism;ti++) {
+			threads.emplace_back([&](int thread_id){
+				if (numa().pin) numa().pin_thread(thread_id);
+				streaming_worker() = thread_id;
+				long local_read_bytes = 0;
+				char * buffer = buffer_pool[thread_id];
+				while (true) {
+					long g = __sync_fetch_and_add(&next_group, 1);
+					if (g >= (long)groups.size()) break;
+					for (size_t c=0;c<groups[g].size();c++) {
+						long bytes = pread(fin, buffer, groups[g][c].second, groups[g][c].first);
+						assert(bytes>0);
+						local_read_bytes += bytes;
+						consume(thread_id, g, buffer, groups[g][c].first, bytes);
+					}
+					resident(thread_id, g);
+				}
+				write_add(&read_bytes, local_read_bytes);
+			}, ti);
+		}
+		for (int i=0;i<parallelism;i++) {
+			threads[i].join();
+		}
+		return read_bytes;
+	}
+
+	// the calling thread keeps up to io_depth reads in flight and passes completed
+	// buffers to the workers, which return them to the submitter once scanned
+	long uring_read_chunks(int fin, std::vector<std::pair<long,long> > & chunks, std::function<void(int, char *, long, long)> consume) {
+		Queue<std::tuple<int, long, long> > ready(io_depth + parallelism);
+		Queue<int> returned(io_depth);
+		std::vector<std::thread> threads;
+		for (int ti=0;ti<parallelism;ti++) {
+			threads.emplace_back([&](int thread_id){
+				if (numa().pin) numa().pin_thread(thread_id);
+				streaming_worker() = thread_id;
+				while (true) {
+					int slot;
+					long offset, bytes;
+					std::tie(slot, offset, bytes) = ready.pop();
+					if (slot==-1) break;
+					consume(thread_id, uring_buffers[slot], offset, bytes);
+					returned.push(slot);
+				}
+			}, ti);
+		}
+
+		std::vector<int> free_slots;
+		std::vector<long> slot_offset(io_depth);
+		for (int i=io_depth-1;i>=0;i--) {
+			free_slots.push_back(i);
+		}
+		long read_bytes = 0;
+		int inflight = 0;
+		unsigned long slot;
+		long res;
+		auto complete = [&]() {
+			if (res<=0) {
+				fprintf(stderr, "io_uring read at %ld failed: %s\n", slot_offset[slot], strerror(-res));
+				exit(-1);
+			}
+			inflight--;
+			read_bytes += res;
+			ready.push(std::make_tuple((int)slot, slot_offset[slot], res));
+		};
+		for (size_t i=0;i<chunks.size();i++) {
+			while (free_slots.empty()) {
+				int s;
+				if (returned.try_pop(s)) {
+					free_slots.push_back(s);
+				} else if (inflight>0) {
+					uring.wait(slot, res);
+					complete();
+				} else {
+					free_slots.push_back(returned.pop());
+				}
+			}
+			int s = free_slots.back();
+			free_slots.pop_back();
+			slot_offset[s] = chunks[i].first;
+			if (!uring.read(fin, uring_buffers[s], s, chunks[i].second, chunks[i].first, s)) {
+				fprintf(stderr, "io_uring submission failed: %s\n", strerror(errno));
+				exit(-1);
+			}
+			inflight++;
+			while (uring.peek(slot, res)) {
+				complete();
+			}
+		}
+		while (inflight>0) {
+			uring.wait(slot, res);
+			complete();
+		}
+
+		for (int i=0;i<parallelism;i++) {
+			ready.push(std::make_tuple(-1, 0l, 0l));
+		}
+		for (int i=0;i<parallelism;i++) {
+			threads[i].join();
+		}
+		return read_bytes;
+	}
+
+	// number of vertices set in bitmap in each partition, from the list of a sparse subset
+	std::vector<VertexId> partition_counts(Bitmap * bitmap) {
+		std::vector<VertexId> counts(partitions, 0);
+		const std::vector<VertexId> * active = bitmap->sparse_vertices();
+		if (active!=NULL) {
+			for (VertexId v : *active) {
+				counts[get_partition_id(partition_bounds.data(), partitions, v)]++;
+			}
+			return counts;
+		}
+		for (int i=0;i<partitions;i++) {
+			VertexId begin_vid, end_vid;
+			std::tie(begin_vid, end_vid) = get_partition_range(partition_bounds.data(), partitions, i);
+			counts[i] = bitmap->count(begin_vid, end_vid);
+		}
+		return counts;
+	}
+
+	// set should_access_shard for the rows of blocks with a vertex in bitmap (all rows if null)
+	void select_shards(Bitmap * bitmap) {
+		const std::vector<VertexId> * active = (bitmap!=nullptr) ? bitmap->sparse_vertices() : NULL;
+		for (int i=0;i<partitions;i++) {
+			should_access_shard[i] = (bitmap==nullptr);
+		}
+		if (active!=NULL) {
+			for (VertexId v : *active) {
+				should_access_shard[get_partition_id(partition_bounds.data(), partitions, v)] = true;
+			}
+		} else if (bitmap!=nullptr) {
 			#pragma omp parallel for schedule(dynamic) num_threads(parallelism)
 			for (int partition_id=0;partition_id<partitions;partition_id++) {
 				VertexId begin_vid, end_vid;
-				std::tie(begin_vid, end_vid) = get_partition_range(vertices, partitions, partition_id);
-				VertexId i = begin_vid;
-				while (i<end_vid) {
-					unsigned long word = bitmap->data[WORD_OFFSET(i)];
-					if (word!=0) {
-						should_access_shard[partition_id] = true;
-						break;
+				std::tie(begin_vid, end_vid) = get_partition_range(partition_bounds.data(), partitions, partition_id);
+				should_access_shard[partition_id] = bitmap->any(begin_vid, end_vid);
+			}
+		}
+	}
+
+	// estimated number of edges leaving the vertices set in bitmap, from the edges of each row of blocks
+	double estimate_edges(Bitmap * bitmap) {
+		std::vector<VertexId> counts = partition_counts(bitmap);
+		double estimate = 0;
+		for (int i=0;i<partitions;i++) {
+			VertexId begin_vid, end_vid;
+			std::tie(begin_vid, end_vid) = get_partition_range(partition_bounds.data(), partitions, i);
+			if (begin_vid==end_vid) continue;
+			long row_bytes = row_offset[(i+1)*partitions] - row_offset[i*partitions];
+			estimate += (double)row_bytes / fsize_total * edges * counts[i] / (end_vid - begin_vid);
+		}
+		return estimate;
+	}
+
+	// calls batch(records, count) on the records in buffer[begin, bytes) that pass filter, at most
+	// BATCH_EDGES at a time, copied to a stack buffer; a range needing no filtering is passed as is
+	template <typename T, typename E, typename B>
+	T scan_batches(char * buffer, long begin, long bytes, const EdgeFilter & filter, T zero, B & batch) {
+		const long stride = edge_stride<E>();
+		long count = (bytes - begin) / stride;
+		if (count <= 0) return zero;
+		char * records = buffer + begin;
+		if (filter.bitmap==NULL && filter.begin_source==0 && filter.end_source==vertices && filter.begin_target==0 && filter.end_target==vertices) {
+			return batch(records, count);
+		}
+		alignas(64) char filtered[BATCH_EDGES * MAX_EDGE_UNIT];
+		T value = zero;
+		for (long k=0;k<count;k+=BATCH_EDGES) {
+			long passed = filter_edges(records + k * stride, std::min((long)BATCH_EDGES, count - k), stride, filter, filtered);
+			if (passed > 0) value += batch(filtered, passed);
+		}
+		return value;
+	}
+
+	// direction-optimizing heuristic: switch from push to pull once the edges leaving the frontier
+	// exceed the edges of the unvisited vertices / PULL_ALPHA, and back once the frontier holds
+	// fewer than vertices / PULL_BETA vertices
+	bool should_pull(bool pulling, Bitmap * frontier, Bitmap * unvisited) {
+		if (!pulling) {
+			return estimate_edges(frontier) > estimate_edges(unvisited) / PULL_ALPHA;
+		}
+		return frontier->count() >= (size_t)vertices / PULL_BETA;
+	}
+
+	// pull (bottom-up) traversal: streams the edges from active sources into the target partitions
+	// that still have bits set in targets, skipping fully settled columns. Each target partition is
+	// processed by a single thread, so process may update target data without atomics. Edges whose
+	// target bit is clear are skipped; once process returns a value other than zero for an edge,
+	// its target is cleared from targets and the remaining edges into it are skipped.
+	template <typename T, typename E = Edge, typename F>
+	T pull_edges(F process, Bitmap * bitmap, Bitmap * targets, T zero = 0,
+		std::function<void(std::pair<VertexId,VertexId> vid_range)> pre_source_window = f_none_1,
+		std::function<void(std::pair<VertexId,VertexId> vid_range)> post_source_window = f_none_1) {
+		check_edge_format<E>();
+		std::vector<bool> should_access_column(partitions);
+		select_shards(bitmap);
+		for (int i=0;i<partitions;i++) {
+			VertexId begin_vid, end_vid;
+			std::tie(begin_vid, end_vid) = get_partition_range(partition_bounds.data(), partitions, i);
+			should_access_column[i] = targets->any(begin_vid, end_vid);
+		}
+
+		bool selective = (index_unit > 0 && bitmap->count() < vertices * INDEX_THRESHOLD);
+		update_edge_cache(!selective, &should_access_column);
+
+		long total_bytes = 0;
+		for (int i=0;i<partitions;i++) {
+			if (!should_access_shard[i]) continue;
+			for (int j=0;j<partitions;j++) {
+				if (should_access_column[j] && cache_data[i*partitions+j]==NULL) total_bytes += fsize[i][j];
+			}
+		}
+		int read_mode = (memory_bytes < total_bytes) ? (O_RDONLY | O_DIRECT) : O_RDONLY;
+
+		Reducer<T> local_values(parallelism, zero);
+		std::vector<int> columns;
+		std::vector<std::vector<std::pair<long,long> > > groups;
+		std::vector<std::vector<int> > group_cached_blocks;
+		int fin = open(column_file().c_str(), read_mode);
+		posix_fadvise(fin, 0, 0, POSIX_FADV_SEQUENTIAL);
+		for (size_t window=0;window+1<window_bounds.size();window++) {
+			int cur_partition = window_bounds[window], end_partition = window_bounds[window+1];
+			VertexId begin_vid = partition_bounds[cur_partition], end_vid = partition_bounds[end_partition];
+			pre_source_window(std::make_pair(begin_vid, end_vid));
+			columns.clear();
+			groups.clear();
+			group_cached_blocks.clear();
+			for (int j=0;j<partitions;j++) {
+				if (!should_access_column[j]) continue;
+				std::vector<std::pair<long,long> > chunks;
+				std::vector<int> cached_blocks;
+				long offset = 0;
+				for (int i=cur_partition;i<end_partition;i++) {
+					if (!should_access_shard[i]) continue;
+					if (cache_data[i*partitions+j]!=NULL) {
+						cached_blocks.push_back(i*partitions+j);
+						continue;
 					}
-					i = (WORD_OFFSET(i) + 1) << 6;
+					if (compressed) {
+						split_frames(column_offset[j*partitions+i], column_offset[j*partitions+i] + fsize[i][j], column_frame_offset, column_frames, chunks);
+					} else {
+						split_chunks(column_offset[j*partitions+i], column_offset[j*partitions+i] + fsize[i][j], offset, chunks);
+					}
+				}
+				if (selective) {
+					select_chunks(chunks, column_index, column_frame_offset, column_frames, bitmap);
 				}
+				if (chunks.empty() && cached_blocks.empty()) continue;
+				columns.push_back(j);
+				groups.push_back(chunks);
+				group_cached_blocks.push_back(cached_blocks);
 			}
-			#pragma omp barrier
+			auto pull_scan = [&](int group, char * buffer, long begin, long bytes){
+				VertexId begin_target, end_target;
+				std::tie(begin_target, end_target) = get_partition_range(partition_bounds.data(), partitions, columns[group]);
+				T local_value = zero;
+				for (long pos=begin;pos+edge_stride<E>()<=bytes;pos+=edge_stride<E>()) {
+					E & e = *(E*)(buffer+pos);
+					if (e.source < begin_vid || e.source >= end_vid) continue;
+					// pages shared with the neighbouring columns are read by their owners too
+					if (e.target < begin_target || e.target >= end_target) continue;
+					if (!targets->get_bit(e.target) || !bitmap->get_bit(e.source)) continue;
+					T result = process(e);
+					if (result!=zero) {
+						targets->clear_bit(e.target);
+						local_value += result;
+					}
+				}
+				return local_value;
+			};
+			read_chunk_groups(fin, groups, [&](int thread_id, int group, char * buffer, long offset, long bytes){
+				std::function<T(char *, long, long)> scan = [&](char * buffer, long begin, long bytes){
+					return pull_scan(group, buffer, begin, bytes);
+				};
+				local_values[thread_id] += scan_chunk(thread_id, buffer, offset, bytes, zero, scan, column_offset, true);
+			}, [&](int thread_id, int group){
+				for (size_t k=0;k<group_cached_blocks[group].size();k++) {
+					int block = group_cached_blocks[group][k];
+					local_values[thread_id] += pull_scan(group, cache_data[block], 0, cache_bytes[block]);
+				}
+			});
+			post_source_window(std::make_pair(begin_vid, end_vid));
 		}
+		close(fin);
 
-		T value = zero;
-		Queue<std::tuple<int, long, long> > tasks(65536);//2^16
-		std::vector<std::thread> threads;
+		return local_values.sum(zero);
+	}
+
+	// compatibility entry point for std::function callbacks; lambdas bind to the template below,
+	// which lets the compiler inline process into the edge loops
+	template <typename T, typename E = Edge>
+	T stream_edges(std::function<T(typename EdgeRecord<E>::type &)> process, Bitmap * bitmap = nullptr, T zero = 0, int update_mode = 1,
+		std::function<void(std::pair<VertexId,VertexId> vid_range)> pre_source_window = f_none_1,
+		std::function<void(std::pair<VertexId,VertexId> vid_range)> post_source_window = f_none_1,
+		std::function<void(std::pair<VertexId,VertexId> vid_range)> pre_target_window = f_none_1,
+		std::function<void(std::pair<VertexId,VertexId> vid_range)> post_target_window = f_none_1) {
+		return stream_edges<T, E, std::function<T(E&)> >(process, bitmap, zero, update_mode, pre_source_window, post_source_window, pre_target_window, post_target_window);
+	}
+
+	template <typename T, typename E = Edge, typename F>
+	T stream_edges(F process, Bitmap * bitmap = nullptr, T zero = 0, int update_mode = 1,
+		std::function<void(std::pair<VertexId,VertexId> vid_range)> pre_source_window = f_none_1,
+		std::function<void(std::pair<VertexId,VertexId> vid_range)> post_source_window = f_none_1,
+		std::function<void(std::pair<VertexId,VertexId> vid_range)> pre_target_window = f_none_1,
+		std::function<void(std::pair<VertexId,VertexId> vid_range)> post_target_window = f_none_1) {
+		auto batch = [&](char * records, long count){
+			T local_value = zero;
+			for (long k=0;k<count;k++) {
+				local_value += process(*(E*)(records + k * edge_stride<E>()));
+			}
+			return local_value;
+		};
+		return stream_edge_ranges<T, E>(batch, bitmap, zero, update_mode, pre_source_window, post_source_window);
+	}
+
+	// batched stream_edges: process(edges, count) receives contiguous spans of typed records whose
+	// sources are active in bitmap (and in the source window in update mode 1), filtered with SIMD
+	// compares; without a bitmap in update mode 0 the records are passed as read, a chunk at a time
+	template <typename T, typename E, typename F>
+	T stream_edge_batches(F process, Bitmap * bitmap = nullptr, T zero = 0, int update_mode = 1,
+		std::function<void(std::pair<VertexId,VertexId> vid_range)> pre_source_window = f_none_1,
+		std::function<void(std::pair<VertexId,VertexId> vid_range)> post_source_window = f_none_1) {
+		static_assert(EdgeFormatOf<E>::format!=-1, "batches need a typed edge record");
+		auto batch = [&](char * records, long count){
+			return process((E*)records, count);
+		};
+		return stream_edge_ranges<T, E>(batch, bitmap, zero, update_mode, pre_source_window, post_source_window);
+	}
+
+	// reads the edges of the active rows in update mode 0 (row file) or 1 (column file, one source
+	// window at a time) and passes the records that pass the filters to batch(records, count)
+	template <typename T, typename E, typename B>
+	T stream_edge_ranges(B & batch, Bitmap * bitmap, T zero, int update_mode,
+		std::function<void(std::pair<VertexId,VertexId> vid_range)> pre_source_window,
+		std::function<void(std::pair<VertexId,VertexId> vid_range)> post_source_window) {
+		check_edge_format<E>();
+		select_shards(bitmap);
+
+		Reducer<T> local_values(parallelism, zero);
+		std::vector<std::pair<long,long> > chunks;
+		std::function<T(char *, long, long)> scan;
+		std::vector<int> cached_blocks;
 		long read_bytes = 0;
 
+		// once the frontier is sparse, read only the parts of the blocks holding active sources
+		bool selective = (bitmap!=nullptr && index_unit > 0 && bitmap->count() < vertices * INDEX_THRESHOLD);
+		update_edge_cache(!selective);
+
 		long total_bytes = 0;
 		for (int i=0;i<partitions;i++) {
 			if (!should_access_shard[i]) continue;
 			for (int j=0;j<partitions;j++) {
-				total_bytes += fsize[i][j];
+				if (cache_data[i*partitions+j]==NULL) total_bytes += fsize[i][j];
 			}
 		}
 		int read_mode;
@@ -294,133 +1204,76 @@ public:
 		long offset = 0;
 		switch(update_mode) {
 		case 0: // source oriented update
-			threads.clear();//函数clear()删除储存在vector中的所有元素. 
-			//vector的尺寸(size)将变成zero. 但它的容量(capacity)却并不发生变化, vector本身并不释放任何内存.
-			for (int ti=0;ti<parallelism;ti++) {
-				threads.emplace_back([&](int thread_id){
-					T local_value = zero;
-					long local_read_bytes = 0;
-					while (true) {
-						int fin;
-						long offset, length;
-						std::tie(fin, offset, length) = tasks.pop();
-						if (fin==-1) break;
-						char * buffer = buffer_pool[thread_id];
-						//ssize_t  pread (int filedes,   void *buf,  size_t  nbytes,  off_t  offset );
-  						//成功：返回读到的字节数；出错：返回-1；到文件结尾：返回0
-						long bytes = pread(fin, buffer, length, offset);//pread()是可以在多线程下使用的
-						assert(bytes>0);
-						local_read_bytes += bytes;
-						// CHECK: start position should be offset % edge_unit
-						for (long pos=offset % edge_unit;pos+edge_unit<=bytes;pos+=edge_unit) {
-							Edge & e = *(Edge*)(buffer+pos);
-							if (bitmap==nullptr || bitmap->get_bit(e.source)) {//第一个true，就不执行第二个
-								local_value += process(e);
-							}
-						}
-					}
-					write_add(&value, local_value);
-					write_add(&read_bytes, local_read_bytes);
-				}, ti);//ti是参数
-			}
 			fin = open((path+"/row").c_str(), read_mode);
 			posix_fadvise(fin, 0, 0, POSIX_FADV_SEQUENTIAL);//对文件进行预取的系统调用POSIX_FADV_SEQUENTIAL将要进行顺序操作   
 			for (int i=0;i<partitions;i++) {
 				if (!should_access_shard[i]) continue;
 				for (int j=0;j<partitions;j++) {
-					long begin_offset = row_offset[i*partitions+j];
-					if (begin_offset - offset >= PAGESIZE) {
-						offset = begin_offset / PAGESIZE * PAGESIZE;
-					}
-					long end_offset = row_offset[i*partitions+j+1];
-					if (end_offset <= offset) continue;
-					while (end_offset - offset >= IOSIZE) {
-						tasks.push(std::make_tuple(fin, offset, IOSIZE));//24M按IOSIZE一页一页传
-						offset += IOSIZE;
+					if (cache_data[i*partitions+j]!=NULL) {
+						cached_blocks.push_back(i*partitions+j);
+						continue;
 					}
-					if (end_offset > offset) {
-						tasks.push(std::make_tuple(fin, offset, (end_offset - offset + PAGESIZE - 1) / PAGESIZE * PAGESIZE));//不能落下余数
-						offset += (end_offset - offset + PAGESIZE - 1) / PAGESIZE * PAGESIZE;
+					if (compressed) {
+						split_frames(row_offset[i*partitions+j], row_offset[i*partitions+j] + fsize[i][j], row_frame_offset, row_frames, chunks);
+					} else {
+						split_chunks(row_offset[i*partitions+j], row_offset[i*partitions+j] + fsize[i][j], offset, chunks);
 					}
 				}
 			}
-			for (int i=0;i<parallelism;i++) {
-				tasks.push(std::make_tuple(-1, 0, 0));
-			}
-			for (int i=0;i<parallelism;i++) {
-				threads[i].join();
+			coalesce_chunks(chunks);
+			if (selective) {
+				select_chunks(chunks, row_index, row_frame_offset, row_frames, bitmap);
 			}
+			scan = [&](char * buffer, long begin, long bytes){
+				EdgeFilter filter = { 0, vertices, 0, vertices, bitmap==nullptr ? NULL : bitmap->data };
+				return scan_batches<T, E>(buffer, begin, bytes, filter, zero, batch);
+			};
+			read_bytes += read_chunks(fin, chunks, [&](int thread_id, char * buffer, long offset, long bytes){
+				local_values[thread_id] += scan_chunk(thread_id, buffer, offset, bytes, zero, scan, row_offset, false);
+			});
+			scan_cached_blocks(cached_blocks, scan, local_values);
 			break;
 		case 1: // target oriented update
-			fin = open((path+"/column").c_str(), read_mode);
+			fin = open(column_file().c_str(), read_mode);
 			posix_fadvise(fin, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-			for (int cur_partition=0;cur_partition<partitions;cur_partition+=partition_batch) {
-				VertexId begin_vid, end_vid;
-				begin_vid = get_partition_range(vertices, partitions, cur_partition).first;
-				if (cur_partition+partition_batch>=partitions) {
-					end_vid = vertices;
-				} else {
-					end_vid = get_partition_range(vertices, partitions, cur_partition+partition_batch).first;
-				}
+			for (size_t window=0;window+1<window_bounds.size();window++) {
+				int cur_partition = window_bounds[window], end_partition = window_bounds[window+1];
+				VertexId begin_vid = partition_bounds[cur_partition], end_vid = partition_bounds[end_partition];
 				pre_source_window(std::make_pair(begin_vid, end_vid));
 				// printf("pre %d %d\n", begin_vid, end_vid);
-				threads.clear();
-				for (int ti=0;ti<parallelism;ti++) {
-					threads.emplace_back([&](int thread_id){
-						T local_value = zero;
-						long local_read_bytes = 0;
-						while (true) {
-							int fin;
-							long offset, length;
-							std::tie(fin, offset, length) = tasks.pop();
-							if (fin==-1) break;
-							char * buffer = buffer_pool[thread_id];
-							long bytes = pread(fin, buffer, length, offset);
-							assert(bytes>0);
-							local_read_bytes += bytes;
-							// CHECK: start position should be offset % edge_unit
-							for (long pos=offset % edge_unit;pos+edge_unit<=bytes;pos+=edge_unit) {
-								Edge & e = *(Edge*)(buffer+pos);
-								if (e.source < begin_vid || e.source >= end_vid) {
-									continue;
-								}
-								if (bitmap==nullptr || bitmap->get_bit(e.source)) {
-									local_value += process(e);
-								}
-							}
-						}
-						write_add(&value, local_value);
-						write_add(&read_bytes, local_read_bytes);
-					}, ti);
-				}
 				offset = 0;
-				for (int j=0;j<partitions;j++) {
-					for (int i=cur_partition;i<cur_partition+partition_batch;i++) {
-						if (i>=partitions) break;
-						if (!should_access_shard[i]) continue;
-						long begin_offset = column_offset[j*partitions+i];
-						if (begin_offset - offset >= PAGESIZE) {
-							offset = begin_offset / PAGESIZE * PAGESIZE;
-						}
-						long end_offset = column_offset[j*partitions+i+1];
-						if (end_offset <= offset) continue;
-						while (end_offset - offset >= IOSIZE) {
-							tasks.push(std::make_tuple(fin, offset, IOSIZE));
-							offset += IOSIZE;
-						}
-						if (end_offset > offset) {
-							tasks.push(std::make_tuple(fin, offset, (end_offset - offset + PAGESIZE - 1) / PAGESIZE * PAGESIZE));
-							offset += (end_offset - offset + PAGESIZE - 1) / PAGESIZE * PAGESIZE;
-						}
+				chunks.clear();
+				cached_blocks.clear();
+				// the blocks of the window in file order: column-major in the column file, row-major
+				// in a single copy grid, so that adjacent blocks coalesce into sequential reads
+				for (int k=0;k<partitions*partitions;k++) {
+					int i = single_copy ? k / partitions : k % partitions;
+					int j = single_copy ? k % partitions : k / partitions;
+					if (i<cur_partition || i>=end_partition) continue;
+					if (!should_access_shard[i]) continue;
+					if (cache_data[i*partitions+j]!=NULL) {
+						cached_blocks.push_back(i*partitions+j);
+						continue;
+					}
+					if (compressed) {
+						split_frames(column_offset[j*partitions+i], column_offset[j*partitions+i] + fsize[i][j], column_frame_offset, column_frames, chunks);
+					} else {
+						split_chunks(column_offset[j*partitions+i], column_offset[j*partitions+i] + fsize[i][j], offset, chunks);
 					}
 				}
-				for (int i=0;i<parallelism;i++) {
-					tasks.push(std::make_tuple(-1, 0, 0));
-				}
-				for (int i=0;i<parallelism;i++) {
-					threads[i].join();
+				coalesce_chunks(chunks);
+				if (selective) {
+					select_chunks(chunks, column_index, column_frame_offset, column_frames, bitmap);
 				}
+				scan = [&](char * buffer, long begin, long bytes){
+					EdgeFilter filter = { begin_vid, end_vid, 0, vertices, bitmap==nullptr ? NULL : bitmap->data };
+					return scan_batches<T, E>(buffer, begin, bytes, filter, zero, batch);
+				};
+				read_bytes += read_chunks(fin, chunks, [&](int thread_id, char * buffer, long offset, long bytes){
+					local_values[thread_id] += scan_chunk(thread_id, buffer, offset, bytes, zero, scan, column_offset, true);
+				});
+				scan_cached_blocks(cached_blocks, scan, local_values);
 				post_source_window(std::make_pair(begin_vid, end_vid));
 				// printf("post %d %d\n", begin_vid, end_vid);
 			}
@@ -432,7 +1285,178 @@ public:
 
 		close(fin);
 		// printf("streamed %ld bytes of edges\n", read_bytes);
-		return value;
+		return local_values.sum(zero);
+	}
+
+	// target-exclusive variant of update mode 1: every target partition (column) is owned by a single
+	// thread at a time, so process(e, values) may update values[e.target] without atomics. targets is
+	// the target data, indexed by vertex id. Columns holding more than a fair share of the edges of a
+	// source window are split into pieces that update thread-local partial arrays filled with identity
+	// instead; when a piece is done, its partial values are folded into targets with merge(target,
+	// partial) under a per-column lock. merge(x, identity) must leave x unchanged.
+	template <typename T, typename V, typename E = Edge, typename F, typename M>
+	T stream_edges_exclusive(F process, V * targets, V identity, M merge,
+		Bitmap * bitmap = nullptr, T zero = 0,
+		std::function<void(std::pair<VertexId,VertexId> vid_range)> pre_source_window = f_none_1,
+		std::function<void(std::pair<VertexId,VertexId> vid_range)> post_source_window = f_none_1) {
+		check_edge_format<E>();
+		VertexId max_partition_size = 0;
+		select_shards(bitmap);
+		for (int i=0;i<partitions;i++) {
+			VertexId begin_vid, end_vid;
+			std::tie(begin_vid, end_vid) = get_partition_range(partition_bounds.data(), partitions, i);
+			max_partition_size = std::max(max_partition_size, end_vid - begin_vid);
+		}
+
+		// the partial arrays of the workers come from the arena before the edge cache is sized, so
+		// they are charged to the memory budget like the other buffers (and reused by the next call)
+		std::vector<V *> partials(parallelism);
+		for (int ti=0;ti<parallelism;ti++) {
+			partials[ti] = (V *)arena().alloc((long)max_partition_size * sizeof(V));
+		}
+		bool selective = (bitmap!=nullptr && index_unit > 0 && bitmap->count() < vertices * INDEX_THRESHOLD);
+		update_edge_cache(!selective);
+
+		long total_bytes = 0;
+		for (int i=0;i<partitions;i++) {
+			if (!should_access_shard[i]) continue;
+			for (int j=0;j<partitions;j++) {
+				if (cache_data[i*partitions+j]==NULL) total_bytes += fsize[i][j];
+			}
+		}
+		int read_mode = (memory_bytes < total_bytes) ? (O_RDONLY | O_DIRECT) : O_RDONLY;
+
+		Reducer<T> local_values(parallelism, zero);
+		std::vector<int> current_group(parallelism, -1);
+		std::vector<std::mutex> column_locks(partitions);
+		// a group is one piece of a column: chunks read from disk and segments of cached blocks
+		std::vector<std::vector<std::pair<long,long> > > groups;
+		std::vector<std::vector<std::pair<char *, long> > > group_segments;
+		std::vector<int> group_columns;
+		std::vector<bool> group_split;
+		std::vector<std::vector<std::pair<long,long> > > column_chunks(partitions);
+		std::vector<std::vector<std::pair<char *, long> > > column_segments(partitions);
+		std::vector<long> column_bytes(partitions);
+		int fin = open(column_file().c_str(), read_mode);
+		posix_fadvise(fin, 0, 0, POSIX_FADV_SEQUENTIAL);
+		for (size_t window=0;window+1<window_bounds.size();window++) {
+			int cur_partition = window_bounds[window], end_partition = window_bounds[window+1];
+			VertexId begin_vid = partition_bounds[cur_partition], end_vid = partition_bounds[end_partition];
+			pre_source_window(std::make_pair(begin_vid, end_vid));
+			long batch_bytes = 0;
+			for (int j=0;j<partitions;j++) {
+				column_chunks[j].clear();
+				column_segments[j].clear();
+				column_bytes[j] = 0;
+				long offset = 0;
+				for (int i=cur_partition;i<end_partition;i++) {
+					if (!should_access_shard[i]) continue;
+					int block = i*partitions+j;
+					if (cache_data[block]!=NULL) {
+						for (long pos=0;pos<cache_bytes[block];pos+=IOSIZE) {
+							column_segments[j].push_back(std::make_pair(cache_data[block] + pos, std::min((long)IOSIZE, cache_bytes[block] - pos)));
+						}
+						continue;
+					}
+					if (compressed) {
+						split_frames(column_offset[j*partitions+i], column_offset[j*partitions+i] + fsize[i][j], column_frame_offset, column_frames, column_chunks[j]);
+					} else {
+						split_chunks(column_offset[j*partitions+i], column_offset[j*partitions+i] + fsize[i][j], offset, column_chunks[j]);
+					}
+				}
+				if (selective) {
+					select_chunks(column_chunks[j], column_index, column_frame_offset, column_frames, bitmap);
+				}
+				for (size_t k=0;k<column_chunks[j].size();k++) {
+					column_bytes[j] += column_chunks[j][k].second;
+				}
+				for (size_t k=0;k<column_segments[j].size();k++) {
+					column_bytes[j] += column_segments[j][k].second;
+				}
+				batch_bytes += column_bytes[j];
+			}
+			// a piece holds at least as many edges as its partial array has entries
+			long share = std::max(batch_bytes / parallelism, (long)max_partition_size * edge_unit);
+			groups.clear();
+			group_segments.clear();
+			group_columns.clear();
+			group_split.clear();
+			for (int j=0;j<partitions;j++) {
+				if (column_bytes[j]==0) continue;
+				long pieces = std::min((column_bytes[j] + share - 1) / share, (long)parallelism);
+				long piece_bytes = (column_bytes[j] + pieces - 1) / pieces;
+				long first_group = groups.size();
+				long filled = piece_bytes;
+				for (size_t k=0;k<column_chunks[j].size()+column_segments[j].size();k++) {
+					if (filled >= piece_bytes) {
+						groups.emplace_back();
+						group_segments.emplace_back();
+						group_columns.push_back(j);
+						filled = 0;
+					}
+					if (k < column_chunks[j].size()) {
+						groups.back().push_back(column_chunks[j][k]);
+						filled += column_chunks[j][k].second;
+					} else {
+						group_segments.back().push_back(column_segments[j][k - column_chunks[j].size()]);
+						filled += column_segments[j][k - column_chunks[j].size()].second;
+					}
+				}
+				for (long g=first_group;g<(long)groups.size();g++) {
+					group_split.push_back(groups.size() - first_group > 1);
+				}
+			}
+
+			// values the edges of group g are accumulated into
+			auto group_values = [&](int thread_id, int g){
+				if (!group_split[g]) return targets;
+				VertexId begin_target = get_partition_range(partition_bounds.data(), partitions, group_columns[g]).first;
+				if (current_group[thread_id]!=g) {
+					std::fill(partials[thread_id], partials[thread_id] + max_partition_size, identity);
+					current_group[thread_id] = g;
+				}
+				return partials[thread_id] - begin_target;
+			};
+			auto exclusive_scan = [&](int thread_id, int g, char * buffer, long begin, long bytes){
+				// pages shared with the neighbouring columns are read by their owners too
+				EdgeFilter filter = { begin_vid, end_vid, 0, 0, bitmap==nullptr ? NULL : bitmap->data };
+				std::tie(filter.begin_target, filter.end_target) = get_partition_range(partition_bounds.data(), partitions, group_columns[g]);
+				V * values = group_values(thread_id, g);
+				auto batch = [&](char * records, long count){
+					T local_value = zero;
+					for (long k=0;k<count;k++) {
+						local_value += process(*(E*)(records + k * edge_stride<E>()), values);
+					}
+					return local_value;
+				};
+				return scan_batches<T, E>(buffer, begin, bytes, filter, zero, batch);
+			};
+			read_chunk_groups(fin, groups, [&](int thread_id, int g, char * buffer, long offset, long bytes){
+				std::function<T(char *, long, long)> scan = [&](char * buffer, long begin, long bytes){
+					return exclusive_scan(thread_id, g, buffer, begin, bytes);
+				};
+				local_values[thread_id] += scan_chunk(thread_id, buffer, offset, bytes, zero, scan, column_offset, true);
+			}, [&](int thread_id, int g){
+				for (size_t k=0;k<group_segments[g].size();k++) {
+					local_values[thread_id] += exclusive_scan(thread_id, g, group_segments[g][k].first, 0, group_segments[g][k].second);
+				}
+				if (!group_split[g]) return;
+				VertexId begin_target, end_target;
+				std::tie(begin_target, end_target) = get_partition_range(partition_bounds.data(), partitions, group_columns[g]);
+				V * values = group_values(thread_id, g);
+				std::lock_guard<std::mutex> lock(column_locks[group_columns[g]]);
+				for (VertexId v=begin_target;v<end_target;v++) {
+					merge(targets[v], values[v]);
+				}
+				current_group[thread_id] = -1;
+			});
+			post_source_window(std::make_pair(begin_vid, end_vid));
+		}
+		close(fin);
+		for (int ti=0;ti<parallelism;ti++) {
+			arena().free(partials[ti]);
+		}
+		return local_values.sum(zero);
 	}
 };
 
@@ -0,0 +1,245 @@
+/*
+Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "core/constants.hpp"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/mempolicy.h>) && defined(__NR_mbind) && defined(__NR_move_pages)
+#include <linux/mempolicy.h>
+#define NUMA_SUPPORTED 1
+#endif
+#endif
+
+// The NUMA nodes of the machine (those with CPUs, read from sysfs) and the placement calls GridGraph
+// uses, built on the raw system calls (no libnuma). Worker thread t of threads belongs to node
+// t * nodes / threads, so the static vertex ranges of BigVector::fill and Bitmap line up with the
+// blocked placement. Memory placement is a no-op on single-node machines.
+// Environment: GRIDGRAPH_PIN=1 pins the worker threads to CPUs of their nodes, GRIDGRAPH_PLACEMENT
+// (first_touch, interleave or blocked) places vertex data.
+class Numa {
+	static std::vector<int> parse_list(std::string text) {
+		std::vector<int> list;
+		const char * p = text.c_str();
+		while (*p) {
+			char * end;
+			long first = strtol(p, &end, 10);
+			if (end==p) break;
+			long last = first;
+			p = end;
+			if (*p=='-') {
+				last = strtol(p + 1, &end, 10);
+				p = end;
+			}
+			for (long x=first;x<=last;x++) {
+				list.push_back(x);
+			}
+			while (*p==',' || *p=='\n' || *p==' ') p++;
+		}
+		return list;
+	}
+	static std::string read_text(std::string filename) {
+		std::string text;
+		FILE * fin = fopen(filename.c_str(), "r");
+		if (fin==NULL) return text;
+		char line[4096];
+		while (fgets(line, sizeof(line), fin)!=NULL) {
+			text += line;
+		}
+		fclose(fin);
+		return text;
+	}
+#ifdef NUMA_SUPPORTED
+	long mbind(void * addr, long bytes, int mode, const std::vector<int> & nodes_used) {
+		long page = sysconf(_SC_PAGESIZE);
+		unsigned long begin = ((unsigned long)addr + page - 1) / page * page;
+		unsigned long end = ((unsigned long)addr + bytes) / page * page;
+		if (end <= begin) return 0;
+		int max_node = 0;
+		for (int k : nodes_used) {
+			if (node_ids[k] > max_node) max_node = node_ids[k];
+		}
+		std::vector<unsigned long> mask(max_node / 64 + 1, 0);
+		for (int k : nodes_used) {
+			mask[node_ids[k] / 64] |= 1ul << (node_ids[k] % 64);
+		}
+		return syscall(__NR_mbind, begin, end - begin, mode, mask.data(), mask.size() * 64 + 1, MPOL_MF_MOVE);
+	}
+#endif
+public:
+	int nodes;
+	std::vector<int> node_ids;
+	std::vector<std::vector<int> > node_cpus;
+	int threads;
+	bool pin;
+	int placement;
+
+	Numa() {
+		std::vector<int> online = parse_list(read_text("/sys/devices/system/node/online"));
+		for (int id : online) {
+			std::vector<int> cpus = parse_list(read_text("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist"));
+			if (cpus.empty()) continue;
+			node_ids.push_back(id);
+			node_cpus.push_back(cpus);
+		}
+		if (node_ids.empty()) {
+			node_ids.push_back(0);
+			node_cpus.push_back(std::vector<int>());
+		}
+		nodes = node_ids.size();
+		threads = std::thread::hardware_concurrency();
+		const char * value = getenv("GRIDGRAPH_PIN");
+		pin = (value!=NULL && atoi(value)!=0);
+		placement = PLACEMENT_FIRST_TOUCH;
+		value = getenv("GRIDGRAPH_PLACEMENT");
+		if (value!=NULL && strcmp(value, "interleave")==0) {
+			placement = PLACEMENT_INTERLEAVE;
+		} else if (value!=NULL && strcmp(value, "blocked")==0) {
+			placement = PLACEMENT_BLOCKED;
+		}
+	}
+
+	int thread_node(int thread) {
+		return (long)thread * nodes / threads;
+	}
+
+	// pin the calling thread, worker thread of the current team, to a CPU of its node
+	bool pin_thread(int thread) {
+		int node = thread_node(thread);
+		if (node_cpus[node].empty()) return false;
+		int first = (node * threads + nodes - 1) / nodes;
+		int cpu = node_cpus[node][(thread - first) % node_cpus[node].size()];
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return sched_setaffinity(0, sizeof(set), &set)==0;
+	}
+
+	// let the calling thread run on every CPU again, e.g. a thread started by a pinned thread
+	bool unpin_thread() {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int k=0;k<nodes;k++) {
+			for (int cpu : node_cpus[k]) {
+				CPU_SET(cpu, &set);
+			}
+		}
+		return CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set)==0;
+	}
+
+	// keep the pages of [addr, addr + bytes) on node (a node index), moving those already resident
+	void bind(void * addr, long bytes, int node) {
+#ifdef NUMA_SUPPORTED
+		if (nodes <= 1) return;
+		mbind(addr, bytes, MPOL_PREFERRED, std::vector<int>(1, node));
+#endif
+	}
+
+	// place the pages of [addr, addr + bytes), an array that worker threads access in static ranges,
+	// round robin over the nodes (interleave) or in one range per node (blocked). The policy governs
+	// anonymous memory; page cache pages of file mappings are only moved if already resident, and
+	// otherwise land on the node of the thread that first faults them.
+	void place(void * addr, long bytes, int placement) {
+#ifdef NUMA_SUPPORTED
+		if (nodes <= 1 || placement==PLACEMENT_FIRST_TOUCH) return;
+		if (placement==PLACEMENT_INTERLEAVE) {
+			std::vector<int> all;
+			for (int k=0;k<nodes;k++) {
+				all.push_back(k);
+			}
+			mbind(addr, bytes, MPOL_INTERLEAVE, all);
+			return;
+		}
+		for (int k=0;k<nodes;k++) {
+			long first = (long)((k * threads + nodes - 1) / nodes) * bytes / threads;
+			long last = (long)(((k + 1) * threads + nodes - 1) / nodes) * bytes / threads;
+			bind((char *)addr + first, last - first, k);
+		}
+#endif
+	}
+
+	// the share of the resident pages of [addr, addr + bytes) that lie on another node than the
+	// worker thread whose static range covers them, i.e. the remote-access ratio of the loops that
+	// split the array evenly over the threads; -1 if no page is resident
+	double remote_ratio(void * addr, long bytes, std::vector<long> * node_pages = NULL) {
+		if (node_pages!=NULL) node_pages->assign(nodes, 0);
+#ifdef NUMA_SUPPORTED
+		long page = sysconf(_SC_PAGESIZE);
+		unsigned long begin = (unsigned long)addr / page * page;
+		long count = ((unsigned long)addr + bytes + page - 1) / page - begin / page;
+		long resident = 0, remote = 0;
+		const long batch = 4096;
+		std::vector<void *> pages(batch);
+		std::vector<int> status(batch);
+		for (long done=0;done<count;done+=batch) {
+			long n = std::min(batch, count - done);
+			for (long i=0;i<n;i++) {
+				pages[i] = (void *)(begin + (done + i) * page);
+			}
+			if (syscall(__NR_move_pages, 0, n, pages.data(), NULL, status.data(), 0)!=0) return -1;
+			for (long i=0;i<n;i++) {
+				if (status[i] < 0) continue;
+				int node = 0;
+				while (node < nodes && node_ids[node]!=status[i]) node++;
+				long offset = std::max(0l, (long)((done + i) * page - ((unsigned long)addr - begin)));
+				int owner = thread_node(std::min((long)threads - 1, offset * threads / std::max(bytes, 1l)));
+				if (node_pages!=NULL && node < nodes) (*node_pages)[node]++;
+				resident++;
+				remote += (node!=owner);
+			}
+		}
+		return resident > 0 ? (double)remote / resident : -1;
+#else
+		return -1;
+#endif
+	}
+
+	// print where the pages of an array are and its remote-access ratio
+	void report(const char * name, void * addr, long bytes) {
+		std::vector<long> node_pages;
+		double ratio = remote_ratio(addr, bytes, &node_pages);
+		printf("numa: %s: %d node(s), %d threads, pages per node", name, nodes, threads);
+		for (int k=0;k<nodes;k++) {
+			printf(" %ld", node_pages[k]);
+		}
+		if (ratio < 0) {
+			printf(", not resident\n");
+		} else {
+			printf(", %.2f%% remote\n", ratio * 100);
+		}
+	}
+};
+
+inline Numa & numa() {
+	static Numa topology;
+	return topology;
+}
+
+#endif
@@ -17,6 +17,10 @@ Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
 #ifndef PARTITION_H
 #define PARTITION_H
 
+#include <vector>
+
+#include "core/type.hpp"
+
 inline size_t get_partition_id(const size_t vertices, const size_t partitions, const size_t vertex_id) {
         if (vertices % partitions==0) {
                 const size_t partition_size = vertices / partitions;
@@ -41,4 +45,32 @@ inline std::pair<size_t, size_t> get_partition_range(const size_t vertices, cons
         return std::make_pair(begin, end);
 }
 
+// Non-uniform partitions are given by bounds: partition i holds the vertices [bounds[i], bounds[i+1]),
+// with bounds[0] = 0 and bounds[partitions] = vertices; empty partitions are allowed.
+
+inline std::vector<VertexId> uniform_partition_bounds(const size_t vertices, const size_t partitions) {
+        std::vector<VertexId> bounds(partitions + 1);
+        for (size_t i=0;i<partitions;i++) {
+                bounds[i] = get_partition_range(vertices, partitions, i).first;
+        }
+        bounds[partitions] = vertices;
+        return bounds;
+}
+
+// the last partition whose first vertex is not above vertex_id, by a branchless binary search
+inline size_t get_partition_id(const VertexId * bounds, const size_t partitions, const size_t vertex_id) {
+        const VertexId * base = bounds;
+        size_t n = partitions;
+        while (n > 1) {
+                const size_t half = n / 2;
+                base = ((size_t)base[half] <= vertex_id) ? base + half : base;
+                n -= half;
+        }
+        return base - bounds;
+}
+
+inline std::pair<size_t, size_t> get_partition_range(const VertexId * bounds, const size_t partitions, const size_t partition_id) {
+        return std::make_pair((size_t)bounds[partition_id], (size_t)bounds[partition_id + 1]);
+}
+
 #endif
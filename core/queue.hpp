@@ -19,17 +19,22 @@ Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
 
 #include <queue>
 #include <mutex>
+#include <atomic>
+#include <thread>
 #include <condition_variable>
 
+#include "core/constants.hpp"
+
+// the original mutex based queue, kept for comparison (see tools/queue_bench.cpp)
 template <typename T>
-class Queue {
+class LockedQueue {
 	const size_t capacity;
 	std::queue<T> queue;
 	std::mutex mutex;
 	std::condition_variable cond_full;
 	std::condition_variable cond_empty;
 public:
-	Queue(const size_t capacity) : capacity(capacity) { }
+	LockedQueue(const size_t capacity) : capacity(capacity) { }
 	void push(const T & item) {
 		std::unique_lock<std::mutex> lock(mutex);
 		//满了就阻塞，等到pop了再继续执行
@@ -48,6 +53,15 @@ public:
 		cond_full.notify_one();
 		return item;
 	}
+	bool try_pop(T & item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		if (is_empty()) return false;
+		item = queue.front();
+		queue.pop();
+		lock.unlock();
+		cond_full.notify_one();
+		return true;
+	}
 	bool is_full() {
 		return queue.size()==capacity;
 	}
@@ -56,4 +70,124 @@ public:
 	}
 };
 
+// Bounded multi-producer/multi-consumer ring without locks on the fast path.
+// Every slot carries a sequence number: a slot at position pos is free for the producer of pos
+// when its sequence is pos, and holds an item for the consumer of pos when it is pos + 1.
+// push/pop first spin for up to spins attempts (0: block right away), then park on a condition
+// variable; the mutex is only taken by parked threads and by the threads waking them up.
+template <typename T>
+class Queue {
+	struct Slot {
+		std::atomic<size_t> sequence;
+		T item;
+	};
+	size_t capacity;
+	size_t mask;
+	Slot * slots;
+	int spins;
+	alignas(64) std::atomic<size_t> enqueue_pos;
+	alignas(64) std::atomic<size_t> dequeue_pos;
+	alignas(64) std::atomic<int> waiting_producers;
+	std::atomic<int> waiting_consumers;
+	std::mutex mutex;
+	std::condition_variable cond_full;
+	std::condition_variable cond_empty;
+
+	void wake(std::atomic<int> & waiting, std::condition_variable & cond) {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiting.load(std::memory_order_relaxed)==0) return;
+		std::lock_guard<std::mutex> lock(mutex);
+		cond.notify_all();
+	}
+	template <typename F>
+	void park(std::atomic<int> & waiting, std::condition_variable & cond, F ready) {
+		std::unique_lock<std::mutex> lock(mutex);
+		waiting.fetch_add(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		cond.wait(lock, ready);
+		waiting.fetch_sub(1);
+	}
+public:
+	Queue(const size_t capacity, int spins = QUEUE_SPINS) : spins(spins), enqueue_pos(0), dequeue_pos(0), waiting_producers(0), waiting_consumers(0) {
+		this->capacity = 2;
+		while (this->capacity < capacity) this->capacity <<= 1;
+		mask = this->capacity - 1;
+		slots = new Slot [this->capacity];
+		for (size_t i=0;i<this->capacity;i++) {
+			slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+	~Queue() {
+		delete [] slots;
+	}
+	bool try_push(const T & item) {
+		size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		while (true) {
+			Slot & slot = slots[pos & mask];
+			long diff = (long)slot.sequence.load(std::memory_order_acquire) - (long)pos;
+			if (diff==0) {
+				if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					slot.item = item;
+					slot.sequence.store(pos + 1, std::memory_order_release);
+					wake(waiting_consumers, cond_empty);
+					return true;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+	bool try_pop(T & item) {
+		size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		while (true) {
+			Slot & slot = slots[pos & mask];
+			long diff = (long)slot.sequence.load(std::memory_order_acquire) - (long)(pos + 1);
+			if (diff==0) {
+				if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					item = slot.item;
+					slot.sequence.store(pos + capacity, std::memory_order_release);
+					wake(waiting_producers, cond_full);
+					return true;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = dequeue_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+	void push(const T & item) {
+		for (int i=0;i<spins;i++) {
+			if (try_push(item)) return;
+			if (i >= 64) std::this_thread::yield();
+		}
+		while (!try_push(item)) {
+			park(waiting_producers, cond_full, [&]{ return !is_full(); });
+		}
+	}
+	T pop() {
+		T item;
+		for (int i=0;i<spins;i++) {
+			if (try_pop(item)) return item;
+			if (i >= 64) std::this_thread::yield();
+		}
+		while (!try_pop(item)) {
+			park(waiting_consumers, cond_empty, [&]{ return !is_empty(); });
+		}
+		return item;
+	}
+	// the slot a push would fill is still taken
+	bool is_full() {
+		size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		return (long)slots[pos & mask].sequence.load(std::memory_order_acquire) - (long)pos < 0;
+	}
+	// the slot a pop would take has not been filled yet
+	bool is_empty() {
+		size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		return (long)slots[pos & mask].sequence.load(std::memory_order_acquire) - (long)(pos + 1) < 0;
+	}
+};
+
 #endif
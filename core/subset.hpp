@@ -0,0 +1,146 @@
+/*
+Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef SUBSET_H
+#define SUBSET_H
+
+#include <omp.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "core/constants.hpp"
+#include "core/type.hpp"
+#include "core/bitmap.hpp"
+#include "core/atomic.hpp"
+
+// the index of the calling thread among the workers of Graph: the edge streaming threads set it
+// to their thread id, every other thread uses its OpenMP thread number
+inline int & streaming_worker() {
+	static thread_local int worker = -1;
+	return worker;
+}
+
+inline int worker_id() {
+	int worker = streaming_worker();
+	return worker >= 0 ? worker : omp_get_thread_num();
+}
+
+// A set of vertices, e.g. a frontier, that is always a valid Bitmap and, while it holds at most
+// size * SPARSE_THRESHOLD vertices, also a sorted list of them. set_bit appends every newly set
+// vertex to the buffer of the calling worker (see worker_id()); sparse_vertices() merges the buffers into the list,
+// which Graph then walks instead of scanning the words, and clear() only resets the words of the
+// listed vertices. Once the vertices outgrow the threshold the subset is dense until the next clear().
+// Bits must be set through VertexSubset (not a Bitmap pointer) to be listed; clear_bit makes the
+// subset dense.
+class VertexSubset : public Bitmap {
+	struct alignas(64) Buffer {
+		std::vector<VertexId> vertices;
+	};
+	std::vector<Buffer, AlignedAllocator<Buffer> > buffers;
+	std::vector<VertexId> list;
+	size_t limit;
+	bool dense;
+
+	void make_dense() {
+		__atomic_store_n(&dense, true, __ATOMIC_RELAXED);
+	}
+public:
+	// threads is the number of workers that set bits; a worker id of threads or more makes the
+	// subset dense
+	VertexSubset(size_t size, int threads) : Bitmap(size), buffers(threads) {
+		limit = std::max((size_t)1, (size_t)(size * SPARSE_THRESHOLD));
+		dense = true; // the words are undefined until the first clear()
+	}
+	bool is_sparse() {
+		return !__atomic_load_n(&dense, __ATOMIC_RELAXED);
+	}
+	void clear() {
+		if (is_sparse()) {
+			// every non-zero word holds a listed vertex, so these are all the non-zero summary words
+			for (VertexId v : list) {
+				data[WORD_OFFSET(v)] = 0;
+				word_summary[v >> 12] = 0;
+				group_summary[v >> 18] = 0;
+			}
+			for (Buffer & buffer : buffers) {
+				for (VertexId v : buffer.vertices) {
+					data[WORD_OFFSET(v)] = 0;
+					word_summary[v >> 12] = 0;
+					group_summary[v >> 18] = 0;
+				}
+			}
+		} else {
+			Bitmap::clear();
+		}
+		list.clear();
+		for (Buffer & buffer : buffers) {
+			buffer.vertices.clear();
+		}
+		dense = false;
+	}
+	void fill() {
+		Bitmap::fill();
+		make_dense();
+	}
+	void set_bit(size_t i) {
+		unsigned long mask = 1ul << BIT_OFFSET(i);
+		unsigned long word = __sync_fetch_and_or(data + WORD_OFFSET(i), mask);
+		if (word==0) mark_word(WORD_OFFSET(i));
+		if ((word & mask) || !is_sparse()) return;
+		int buffer = worker_id();
+		if (buffer >= (int)buffers.size() || buffers[buffer].vertices.size() >= limit) {
+			make_dense();
+			return;
+		}
+		buffers[buffer].vertices.push_back(i);
+	}
+	void clear_bit(size_t i) {
+		make_dense();
+		Bitmap::clear_bit(i);
+	}
+	// merges the vertices added since the last call; must not run concurrently with set_bit
+	const std::vector<VertexId> * sparse_vertices() {
+		if (!is_sparse()) return NULL;
+		size_t sorted = list.size();
+		for (Buffer & buffer : buffers) {
+			list.insert(list.end(), buffer.vertices.begin(), buffer.vertices.end());
+			buffer.vertices.clear();
+		}
+		if (list.size() > limit) {
+			make_dense();
+			return NULL;
+		}
+		if (list.size() > sorted) {
+			std::sort(list.begin() + sorted, list.end());
+			std::inplace_merge(list.begin(), list.begin() + sorted, list.end());
+		}
+		return &list;
+	}
+	using Bitmap::count;
+	size_t count() {
+		const std::vector<VertexId> * vertices = sparse_vertices();
+		return vertices!=NULL ? vertices->size() : Bitmap::count();
+	}
+	bool any(size_t begin, size_t end) {
+		const std::vector<VertexId> * vertices = sparse_vertices();
+		if (vertices==NULL) return Bitmap::any(begin, end);
+		auto it = std::lower_bound(vertices->begin(), vertices->end(), (VertexId)begin);
+		return it!=vertices->end() && (size_t)*it < end;
+	}
+};
+
+#endif
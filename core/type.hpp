@@ -17,6 +17,8 @@ Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
 #ifndef TYPE_H
 #define TYPE_H
 
+#include <string.h>
+
 typedef int VertexId;
 typedef long EdgeId;
 typedef float Weight;
@@ -27,6 +29,89 @@ struct Edge {
 	Weight weight;
 };
 
+// Edge record formats of a grid: source and target followed by a fixed size payload.
+// Edge is the historical view used for both unweighted (8 bytes, weight not valid) and float
+// weighted (12 bytes) grids; the typed records below have the exact size of a grid format, so
+// that stream_edges can step through the buffers with a compile-time stride.
+struct UnweightedEdge {
+	VertexId source;
+	VertexId target;
+};
+
+template <typename W>
+struct WeightedEdge {
+	VertexId source;
+	VertexId target;
+	W weight;
+};
+
+struct TimestampEdge {
+	VertexId source;
+	VertexId target;
+	long timestamp;
+};
+
+struct LabelEdge {
+	VertexId source;
+	VertexId target;
+	int label;
+};
+
+#define MAX_EDGE_UNIT 16
+
+enum EdgeFormat {
+	EDGE_UNWEIGHTED, // UnweightedEdge, edge type 0
+	EDGE_FLOAT,      // WeightedEdge<float>, edge type 1
+	EDGE_DOUBLE,     // WeightedEdge<double>
+	EDGE_INT,        // WeightedEdge<int>
+	EDGE_TIMESTAMP,  // TimestampEdge
+	EDGE_LABEL,      // LabelEdge
+	EDGE_FORMATS
+};
+
+// format of a record type; -1 for Edge, which adapts to the grid
+template <typename E> struct EdgeFormatOf { };
+template <> struct EdgeFormatOf<Edge> { static const int format = -1; };
+template <> struct EdgeFormatOf<UnweightedEdge> { static const int format = EDGE_UNWEIGHTED; };
+template <> struct EdgeFormatOf<WeightedEdge<float> > { static const int format = EDGE_FLOAT; };
+template <> struct EdgeFormatOf<WeightedEdge<double> > { static const int format = EDGE_DOUBLE; };
+template <> struct EdgeFormatOf<WeightedEdge<int> > { static const int format = EDGE_INT; };
+template <> struct EdgeFormatOf<TimestampEdge> { static const int format = EDGE_TIMESTAMP; };
+template <> struct EdgeFormatOf<LabelEdge> { static const int format = EDGE_LABEL; };
+
+// E as a non-deduced context, so that stream_edges<T>(lambda) falls back to the default Edge
+template <typename E> struct EdgeRecord { typedef E type; };
+
+inline const char * edge_format_name(int format) {
+	static const char * names[EDGE_FORMATS] = { "unweighted", "float", "double", "int", "timestamp", "label" };
+	return names[format];
+}
+
+// bytes of a record of the given format
+inline int edge_format_unit(int format) {
+	static const int units[EDGE_FORMATS] = {
+		sizeof(UnweightedEdge), sizeof(WeightedEdge<float>), sizeof(WeightedEdge<double>),
+		sizeof(WeightedEdge<int>), sizeof(TimestampEdge), sizeof(LabelEdge)
+	};
+	return units[format];
+}
+
+// the format named name, or -1
+inline int parse_edge_format(const char * name) {
+	for (int format=0;format<EDGE_FORMATS;format++) {
+		if (strcmp(name, edge_format_name(format))==0) return format;
+	}
+	return -1;
+}
+
+// the smallest multiple of 4096 bytes holding whole records, so that page aligned reads
+// (O_DIRECT) never split a record
+inline long edge_page_size(int edge_unit) {
+	long page = 4096;
+	while (page % edge_unit != 0) page += 4096;
+	return page;
+}
+
 struct MergeStatus {
   int id;
   long begin_offset;
@@ -0,0 +1,206 @@
+/*
+Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define URING_SUPPORTED 1
+#endif
+#endif
+
+// A minimal io_uring wrapper built on the raw system calls (no liburing),
+// used by Graph to keep many reads of registered buffers in flight.
+// Only one thread may submit and reap on a given ring.
+class Uring {
+#ifdef URING_SUPPORTED
+	int ring_fd;
+	void * sq_ptr;
+	void * cq_ptr;
+	size_t sq_size;
+	size_t cq_size;
+	unsigned * sq_head;
+	unsigned * sq_tail;
+	unsigned * sq_mask;
+	unsigned * sq_array;
+	struct io_uring_sqe * sqes;
+	size_t sqes_size;
+	unsigned * cq_head;
+	unsigned * cq_tail;
+	unsigned * cq_mask;
+	struct io_uring_cqe * cqes;
+	bool fixed_buffers;
+#endif
+public:
+	Uring() {
+#ifdef URING_SUPPORTED
+		ring_fd = -1;
+		fixed_buffers = false;
+#endif
+	}
+	~Uring() {
+		close();
+	}
+	bool is_open() {
+#ifdef URING_SUPPORTED
+		return ring_fd!=-1;
+#else
+		return false;
+#endif
+	}
+	bool init(unsigned entries) {
+#ifdef URING_SUPPORTED
+		struct io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+		if (ring_fd<0) {
+			ring_fd = -1;
+			return false;
+		}
+		sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+		if (p.features & IORING_FEAT_SINGLE_MMAP) {
+			if (cq_size > sq_size) sq_size = cq_size;
+			cq_size = sq_size;
+		}
+		sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+		if (sq_ptr==MAP_FAILED) {
+			::close(ring_fd);
+			ring_fd = -1;
+			return false;
+		}
+		if (p.features & IORING_FEAT_SINGLE_MMAP) {
+			cq_ptr = sq_ptr;
+		} else {
+			cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+			if (cq_ptr==MAP_FAILED) {
+				munmap(sq_ptr, sq_size);
+				::close(ring_fd);
+				ring_fd = -1;
+				return false;
+			}
+		}
+		sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+		sqes = (struct io_uring_sqe *)mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+		if (sqes==MAP_FAILED) {
+			if (cq_ptr!=sq_ptr) munmap(cq_ptr, cq_size);
+			munmap(sq_ptr, sq_size);
+			::close(ring_fd);
+			ring_fd = -1;
+			return false;
+		}
+		sq_head = (unsigned *)((char *)sq_ptr + p.sq_off.head);
+		sq_tail = (unsigned *)((char *)sq_ptr + p.sq_off.tail);
+		sq_mask = (unsigned *)((char *)sq_ptr + p.sq_off.ring_mask);
+		sq_array = (unsigned *)((char *)sq_ptr + p.sq_off.array);
+		cq_head = (unsigned *)((char *)cq_ptr + p.cq_off.head);
+		cq_tail = (unsigned *)((char *)cq_ptr + p.cq_off.tail);
+		cq_mask = (unsigned *)((char *)cq_ptr + p.cq_off.ring_mask);
+		cqes = (struct io_uring_cqe *)((char *)cq_ptr + p.cq_off.cqes);
+		fixed_buffers = false;
+		return true;
+#else
+		return false;
+#endif
+	}
+	// pin the buffers in the kernel so reads can skip per-request page mapping
+	bool register_buffers(char ** buffers, int count, long length) {
+#ifdef URING_SUPPORTED
+		struct iovec * iovecs = new struct iovec [count];
+		for (int i=0;i<count;i++) {
+			iovecs[i].iov_base = buffers[i];
+			iovecs[i].iov_len = length;
+		}
+		int ret = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, iovecs, count);
+		delete [] iovecs;
+		fixed_buffers = (ret==0);
+		return fixed_buffers;
+#else
+		return false;
+#endif
+	}
+	// queue and submit one read; buffer_id is the index passed to register_buffers
+	bool read(int fd, char * buffer, int buffer_id, long length, long offset, unsigned long user_data) {
+#ifdef URING_SUPPORTED
+		unsigned tail = *sq_tail;
+		unsigned index = tail & *sq_mask;
+		struct io_uring_sqe * sqe = &sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+		sqe->fd = fd;
+		sqe->off = offset;
+		sqe->addr = (unsigned long)buffer;
+		sqe->len = length;
+		if (fixed_buffers) sqe->buf_index = buffer_id;
+		sqe->user_data = user_data;
+		sq_array[index] = index;
+		__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+		int ret;
+		do {
+			ret = syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, NULL, 0);
+		} while (ret<0 && errno==EINTR);
+		return ret==1;
+#else
+		return false;
+#endif
+	}
+	// reap one completed request if there is any; res is the byte count or -errno
+	bool peek(unsigned long & user_data, long & res) {
+#ifdef URING_SUPPORTED
+		unsigned head = *cq_head;
+		if (head==__atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return false;
+		struct io_uring_cqe * cqe = &cqes[head & *cq_mask];
+		user_data = cqe->user_data;
+		res = cqe->res;
+		__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+		return true;
+#else
+		return false;
+#endif
+	}
+	// block until one request completes
+	void wait(unsigned long & user_data, long & res) {
+#ifdef URING_SUPPORTED
+		while (!peek(user_data, res)) {
+			syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		}
+#else
+		res = -ENOSYS;
+#endif
+	}
+	void close() {
+#ifdef URING_SUPPORTED
+		if (ring_fd==-1) return;
+		munmap(sqes, sqes_size);
+		if (cq_ptr!=sq_ptr) munmap(cq_ptr, cq_size);
+		munmap(sq_ptr, sq_size);
+		::close(ring_fd);
+		ring_fd = -1;
+#endif
+	}
+};
+
+#endif
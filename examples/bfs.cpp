@@ -27,34 +27,48 @@ int main(int argc, char ** argv) {
 
 	Graph graph(path);
 	graph.set_memory_bytes(memory_bytes);
-	Bitmap * active_in = graph.alloc_bitmap();
-	Bitmap * active_out = graph.alloc_bitmap();
+	VertexSubset * active_in = graph.alloc_subset();
+	VertexSubset * active_out = graph.alloc_subset();
+	Bitmap * unvisited = graph.alloc_bitmap();
 	BigVector<VertexId> parent(graph.path+"/parent", graph.vertices);
 	graph.set_vertex_data_bytes( graph.vertices * sizeof(VertexId) );
 
 	active_out->clear();
 	active_out->set_bit(start_vid);//？？？？
-	parent.fill(-1);
+	unvisited->fill();
+	unvisited->clear_bit(start_vid);
+	parent.set_default(-1);
 	parent[start_vid] = start_vid;
 	VertexId active_vertices = 1;
 
 	double start_time = get_time();
 	int iteration = 0;
+	bool pull = false;
 	while (active_vertices!=0) {
 		iteration++;
-		printf("%7d: %d\n", iteration, active_vertices);
 		std::swap(active_in, active_out);
 		active_out->clear();
 		graph.hint(parent);
-		active_vertices = graph.stream_edges<VertexId>([&](Edge & e){
-			if (parent[e.target]==-1) {
-				if (cas(&parent[e.target], -1, e.source)) {
-					active_out->set_bit(e.target);//bfs序列加入一个顶点
-					return 1;
+		pull = graph.should_pull(pull, active_in, unvisited);
+		printf("%7d: %d (%s)\n", iteration, active_vertices, pull ? "pull" : "push");
+		if (pull) {
+			active_vertices = graph.pull_edges<VertexId>([&](Edge & e){
+				parent[e.target] = e.source;
+				active_out->set_bit(e.target);
+				return 1;
+			}, active_in, unvisited);
+		} else {
+			active_vertices = graph.stream_edges<VertexId>([&](Edge & e){
+				if (parent[e.target]==-1) {
+					if (cas(&parent[e.target], -1, e.source)) {
+						active_out->set_bit(e.target);//bfs序列加入一个顶点
+						unvisited->clear_bit(e.target);
+						return 1;
+					}
 				}
-			}
-			return 0;
-		}, active_in);
+				return 0;
+			}, active_in);
+		}
 	}
 	double end_time = get_time();
 
@@ -53,8 +53,8 @@ int main(int argc, char ** argv) {
 			return 0;
 		}, nullptr, 0,
 		[&](std::pair<VertexId,VertexId> vid_range){
-			pagerank.load(vid_range.first, vid_range.second);
-			sum.load(vid_range.first, vid_range.second);
+			pagerank.load(vid_range.first, vid_range.second, WINDOW_WRITE_ONLY);
+			sum.load(vid_range.first, vid_range.second, WINDOW_WRITE_ONLY);
 		},
 		[&](std::pair<VertexId,VertexId> vid_range){
 			pagerank.save();
@@ -64,11 +64,11 @@ int main(int argc, char ** argv) {
 
 	for (int iter=0;iter<iterations;iter++) {
 		graph.hint(pagerank);
-		graph.stream_edges<VertexId>(
-			[&](Edge & e){
-				write_add(&sum[e.target], pagerank[e.source]);
+		graph.stream_edges_exclusive<VertexId, float>(
+			[&](Edge & e, float * sum_values){
+				sum_values[e.target] += pagerank[e.source];
 				return 0;
-			}, nullptr, 0, 1,
+			}, sum.data, 0.f, [](float & a, float b){ a += b; }, nullptr, 0,
 			[&](std::pair<VertexId,VertexId> source_vid_range){
 				pagerank.lock(source_vid_range.first, source_vid_range.second);
 			},
@@ -84,7 +84,7 @@ int main(int argc, char ** argv) {
 					return 0;
 				}, nullptr, 0,
 				[&](std::pair<VertexId,VertexId> vid_range){
-					pagerank.load(vid_range.first, vid_range.second);
+					pagerank.load(vid_range.first, vid_range.second, WINDOW_WRITE_ONLY);
 				},
 				[&](std::pair<VertexId,VertexId> vid_range){
 					pagerank.save();
@@ -98,7 +98,7 @@ int main(int argc, char ** argv) {
 					return 0;
 				}, nullptr, 0,
 				[&](std::pair<VertexId,VertexId> vid_range){
-					pagerank.load(vid_range.first, vid_range.second);
+					pagerank.load(vid_range.first, vid_range.second, WINDOW_WRITE_ONLY);
 					sum.load(vid_range.first, vid_range.second);
 				},
 				[&](std::pair<VertexId,VertexId> vid_range){
@@ -65,7 +65,7 @@ int main(int argc, char ** argv) {
 		active_out->clear();
 		active_vertices = graph.stream_edges<VertexId>([&](Edge & e) {
 			if (visited[e.target][now] != visited[e.source][now]) {
-				__sync_fetch_and_or( &visited[e.target][next], visited[e.source][now] );
+				write_or(&visited[e.target][next], visited[e.source][now]);
 				VertexId old_radii = radii[e.target];
 				if (radii[e.target]!=iteration) {
 					if (cas(&radii[e.target], old_radii, iteration)) {
@@ -121,7 +121,7 @@ int main(int argc, char ** argv) {
 		active_out->clear();
 		active_vertices = graph.stream_edges<VertexId>([&](Edge & e) {
 			if (visited[e.target][now] != visited[e.source][now]) {
-				__sync_fetch_and_or( &visited[e.target][next], visited[e.source][now] );
+				write_or(&visited[e.target][next], visited[e.source][now]);
 				VertexId old_radii = radii[e.target];
 				if (radii[e.target]!=iteration) {
 					if (cas(&radii[e.target], old_radii, iteration)) {
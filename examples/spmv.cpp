@@ -49,11 +49,11 @@ int main(int argc, char ** argv) {
 		}
 	);
 	graph.hint(input);
-	graph.stream_edges<float>(
-		[&](Edge & e){
-			write_add(&output[e.target], input[e.source] * e.weight);
+	graph.stream_edges_exclusive<float, float, WeightedEdge<float> >(
+		[&](WeightedEdge<float> & e, float * output_values){
+			output_values[e.target] += input[e.source] * e.weight;
 			return 0;
-		}, nullptr, 0, 1,
+		}, output.data, 0.f, [](float & a, float b){ a += b; }, nullptr, 0,
 		[&](std::pair<VertexId,VertexId> source_vid_range){
 			input.lock(source_vid_range.first, source_vid_range.second);
 		},
@@ -26,8 +26,8 @@ int main(int argc, char ** argv) {
 
 	Graph graph(path);
 	graph.set_memory_bytes(memory_bytes);
-	Bitmap * active_in = graph.alloc_bitmap();
-	Bitmap * active_out = graph.alloc_bitmap();
+	VertexSubset * active_in = graph.alloc_subset();
+	VertexSubset * active_out = graph.alloc_subset();
 	BigVector<VertexId> label(graph.path+"/label", graph.vertices);
 	graph.set_vertex_data_bytes( graph.vertices * sizeof(VertexId) );
 
@@ -45,15 +45,14 @@ int main(int argc, char ** argv) {
 		std::swap(active_in, active_out);
 		active_out->clear();
 		graph.hint(label);
-		active_vertices = graph.stream_edges<VertexId>([&](Edge & e){
-			if (label[e.source]<label[e.target]) {
-				if (write_min(&label[e.target], label[e.source])) {
-					active_out->set_bit(e.target);
-					return 1;
-				}
+		active_vertices = graph.stream_edges_exclusive<VertexId, VertexId>([&](Edge & e, VertexId * label_values){
+			if (label[e.source]<label[e.target] && label[e.source]<label_values[e.target]) {
+				label_values[e.target] = label[e.source];
+				active_out->set_bit(e.target);
+				return 1;
 			}
 			return 0;
-		}, active_in);
+		}, label.data, graph.vertices, [](VertexId & a, VertexId b){ if (b<a) a = b; }, active_in);
 	}
 	double end_time = get_time();
 
@@ -0,0 +1,93 @@
+/*
+Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+#include <thread>
+#include <functional>
+
+#include "core/atomic.hpp"
+#include "core/time.hpp"
+
+// the previous write_add: a compare-and-swap loop for every type
+template <class ET>
+inline void cas_loop_add(ET *a, ET b) {
+	volatile ET newV, oldV;
+	do {oldV = *a; newV = oldV + b;}
+	while (!cas(a, (ET)oldV, (ET)newV));
+}
+
+// every thread applies op(thread_id, i) for i in [0, ops); returns Mops/s
+double run(int threads, long ops, std::function<void(int, long)> op) {
+	std::vector<std::thread> workers;
+	double begin_time = get_time();
+	for (int ti=0;ti<threads;ti++) {
+		workers.emplace_back([&](int thread_id){
+			for (long i=0;i<ops;i++) {
+				op(thread_id, i);
+			}
+		}, ti);
+	}
+	for (int ti=0;ti<threads;ti++) {
+		workers[ti].join();
+	}
+	return threads * ops / (get_time() - begin_time) / 1e6;
+}
+
+int main(int argc, char ** argv) {
+	long ops = (argc>=2)?atol(argv[1]):1000000;
+	long addresses = (argc>=3)?atol(argv[2]):1;
+	int max_threads = (argc>=4)?atoi(argv[3]):64;
+
+	// addresses counters 64 bytes apart; 1 is the fully contended case (a hub vertex)
+	std::vector<long> longs(addresses * 8);
+	std::vector<float> floats(addresses * 16);
+	std::vector<int> ints(addresses * 16);
+	unsigned long pairs[2] __attribute__((aligned(16)));
+
+	printf("%ld ops per thread on %ld addresses (Mops/s)\n", ops, addresses);
+	printf("%8s %12s %12s %12s %12s %12s %12s %12s\n", "threads", "cas-loop", "write_add", "relaxed", "float add", "write_min", "cas 16B", "reducer");
+	for (int threads=1;threads<=max_threads;threads*=2) {
+		double results[7];
+		results[0] = run(threads, ops, [&](int t, long i){ cas_loop_add(&longs[(i % addresses) * 8], 1l); });
+		results[1] = run(threads, ops, [&](int t, long i){ write_add(&longs[(i % addresses) * 8], 1l); });
+		results[2] = run(threads, ops, [&](int t, long i){ write_add(&longs[(i % addresses) * 8], 1l, __ATOMIC_RELAXED); });
+		results[3] = run(threads, ops, [&](int t, long i){ write_add(&floats[(i % addresses) * 16], 1.f); });
+		results[4] = run(threads, ops, [&](int t, long i){ write_min(&ints[(i % addresses) * 16], (int)(ops - i)); });
+		results[5] = run(threads, ops, [&](int t, long i){
+			typedef struct { unsigned long v[2]; } Pair;
+			Pair * p = (Pair *)pairs;
+			Pair old = atomic_load(p), next = old;
+			next.v[0]++;
+			next.v[1] |= 1ul << t % 64;
+			cas(p, old, next);
+		});
+		Reducer<long> reducer(threads);
+		results[6] = run(threads, ops, [&](int t, long i){ reducer[t] += 1; });
+		printf("%8d", threads);
+		for (int k=0;k<7;k++) {
+			printf(" %12.2f", results[k]);
+		}
+		printf("\n");
+		if (reducer.sum() != threads * ops) {
+			fprintf(stderr, "reducer lost updates\n");
+			exit(-1);
+		}
+	}
+	return 0;
+}
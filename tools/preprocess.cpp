@@ -19,13 +19,18 @@ Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
 #include <unistd.h>
 #include <fcntl.h>
 #include <malloc.h>
+#include <sys/mman.h>
 #include <errno.h>
 #include <assert.h>
 #include <string.h>
+#include <math.h>
 
 #include <string>
 #include <vector>
 #include <thread>
+#include <algorithm>
+#include <tuple>
+#include <limits>
 
 #include "core/constants.hpp"
 #include "core/type.hpp"
@@ -34,29 +39,776 @@ Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
 #include "core/partition.hpp"
 #include "core/time.hpp"
 #include "core/atomic.hpp"
+#include "core/compress.hpp"
 
 long PAGESIZE = 4096;
 
-void generate_edge_grid(std::string input, std::string output, VertexId vertices, int partitions, int edge_type)
+// an edge record of any format, with its payload (at most 8 bytes) kept raw
+struct BlockEdge
 {
-	int parallelism = std::thread::hardware_concurrency(); //返回硬件线程上下文的数量。
-	int edge_unit;
-	EdgeId edges;
-	switch (edge_type)
+	VertexId source;
+	VertexId target;
+	unsigned long payload;
+};
+
+void pwrite_all(int fd, const char *buffer, long bytes, long offset)
+{
+	for (long done = 0; done < bytes;)
 	{
-	case 0:
-		edge_unit = sizeof(VertexId) * 2;
-		edges = file_size(input) / edge_unit;
+		long write_bytes = pwrite(fd, buffer + done, bytes - done, offset + done);
+		assert(write_bytes > 0);
+		done += write_bytes;
+	}
+}
+
+bool is_regular_file(std::string filename)
+{
+	struct stat st;
+	return stat(filename.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// reads an unsigned decimal field of [p, eol) and the separators after it; fails if the value
+// does not fit in a VertexId
+bool parse_text_field(const char *&p, const char *eol, unsigned long &value)
+{
+	const unsigned long max_value = std::numeric_limits<VertexId>::max();
+	if (p == eol || *p < '0' || *p > '9')
+		return false;
+	value = 0;
+	while (p < eol && *p >= '0' && *p <= '9')
+	{
+		value = value * 10 + (*p - '0');
+		if (value > max_value)
+			return false;
+		p++;
+	}
+	while (p < eol && (*p == ' ' || *p == '\t' || *p == ',' || *p == '\r'))
+		p++;
+	return true;
+}
+
+// parses the lines of text into edge records of edge_format: a source, a target and, if the format
+// has a payload, a weight, timestamp or label, separated by spaces, tabs or commas (SNAP, TSV and CSV
+// edge lists); empty lines and lines starting with # or % are skipped. Returns the bytes written to out.
+long parse_edge_text(const char *text, long length, int edge_format, char *out)
+{
+	int edge_unit = edge_format_unit(edge_format);
+	const char *end = text + length;
+	char *record = out;
+	for (const char *p = text; p < end;)
+	{
+		const char *eol = (const char *)memchr(p, '\n', end - p);
+		if (eol == NULL)
+			eol = end;
+		const char *line = p;
+		while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r'))
+			p++;
+		if (p < eol && *p != '#' && *p != '%')
+		{
+			unsigned long source, target;
+			bool valid = parse_text_field(p, eol, source) && parse_text_field(p, eol, target);
+			if (valid && edge_format != EDGE_UNWEIGHTED)
+			{
+				// the payload is parsed from a terminated copy, as the text is not
+				char field[64];
+				long field_length = 0;
+				while (p < eol && field_length < 63 && *p != ' ' && *p != '\t' && *p != ',' && *p != '\r')
+					field[field_length++] = *p++;
+				field[field_length] = '\0';
+				char *field_end;
+				if (edge_format == EDGE_FLOAT)
+					*(float *)(record + sizeof(VertexId) * 2) = strtof(field, &field_end);
+				else if (edge_format == EDGE_DOUBLE)
+					*(double *)(record + sizeof(VertexId) * 2) = strtod(field, &field_end);
+				else if (edge_format == EDGE_TIMESTAMP)
+					*(long *)(record + sizeof(VertexId) * 2) = strtol(field, &field_end, 10);
+				else
+					*(int *)(record + sizeof(VertexId) * 2) = strtol(field, &field_end, 10);
+				valid = (field_length > 0 && *field_end == '\0');
+			}
+			if (!valid)
+			{
+				fprintf(stderr, "malformed edge: %.*s\n", (int)(eol - line), line);
+				exit(-1);
+			}
+			*(VertexId *)record = source;
+			*(VertexId *)(record + sizeof(VertexId)) = target;
+			record += edge_unit;
+		}
+		p = eol + 1;
+	}
+	return record - out;
+}
+
+// a text line is at least 4 bytes ("0 0\n") for an 8 byte record and 6 bytes for up to 16 bytes,
+// so the records of a piece of text of this size fit in IOSIZE bytes
+#define TEXT_PIECE (IOSIZE / 3)
+
+// offsets splitting text into pieces of about TEXT_PIECE bytes that end at line ends
+std::vector<long> split_text_lines(const char *text, long bytes)
+{
+	std::vector<long> pieces(1, 0);
+	while (pieces.back() < bytes)
+	{
+		long next = std::min(pieces.back() + (long)TEXT_PIECE, bytes);
+		const char *eol = (const char *)memchr(text + next - 1, '\n', bytes - next + 1);
+		pieces.push_back(eol == NULL ? bytes : eol - text + 1);
+		if (pieces.back() - pieces[pieces.size() - 2] > IOSIZE / 2)
+		{
+			fprintf(stderr, "edge list line too long near byte %ld.\n", next);
+			exit(-1);
+		}
+	}
+	return pieces;
+}
+
+// number of lines of a text edge list, extrapolated from its first TEXT_PIECE bytes
+long estimate_text_edges(std::string input)
+{
+	long bytes = file_size(input);
+	int fin = open(input.c_str(), O_RDONLY);
+	assert(fin != -1);
+	std::vector<char> sample(std::min(bytes, (long)TEXT_PIECE));
+	long sampled = pread(fin, sample.data(), sample.size(), 0);
+	close(fin);
+	if (sampled <= 0)
+		return 0;
+	long lines = std::count(sample.begin(), sample.begin() + sampled, '\n');
+	return std::max(1l, lines) * bytes / sampled;
+}
+
+// parse a text edge list into a binary one, splitting the mapped text at line ends across threads
+void convert_edge_text(std::string input, std::string output, int edge_format)
+{
+	int parallelism = std::thread::hardware_concurrency();
+	double start_time = get_time();
+	long bytes = file_size(input);
+	int fin = open(input.c_str(), O_RDONLY);
+	assert(fin != -1);
+	const char *text = (const char *)mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fin, 0);
+	assert(bytes == 0 || text != MAP_FAILED);
+	madvise((void *)text, bytes, MADV_SEQUENTIAL);
+	std::vector<long> pieces = split_text_lines(text, bytes);
+	int fout = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	assert(fout != -1);
+	long written = 0;
+	#pragma omp parallel num_threads(parallelism)
+	{
+		char *records = (char *)memalign(PAGESIZE, IOSIZE);
+		#pragma omp for schedule(dynamic)
+		for (long k = 0; k < (long)pieces.size() - 1; k++)
+		{
+			long record_bytes = parse_edge_text(text + pieces[k], pieces[k + 1] - pieces[k], edge_format, records);
+			pwrite_all(fout, records, record_bytes, __sync_fetch_and_add(&written, record_bytes));
+		}
+		free(records);
+	}
+	close(fout);
+	munmap((void *)text, bytes);
+	close(fin);
+	printf("parsed %ld edges of text in %.2f seconds\n", written / edge_format_unit(edge_format), get_time() - start_time);
+}
+
+// copy a stream (stdin or a pipe) to a file, for the modes that read the input more than once
+void spool_input(std::string input, std::string output)
+{
+	int fin = (input == "-") ? 0 : open(input.c_str(), O_RDONLY);
+	assert(fin != -1);
+	int fout = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	assert(fout != -1);
+	char *buffer = (char *)memalign(PAGESIZE, IOSIZE);
+	long offset = 0;
+	while (true)
+	{
+		long bytes = read(fin, buffer, IOSIZE);
+		assert(bytes != -1);
+		if (bytes == 0)
+			break;
+		pwrite_all(fout, buffer, bytes, offset);
+		offset += bytes;
+	}
+	free(buffer);
+	close(fout);
+	if (fin != 0)
+		close(fin);
+}
+
+// load bytes of edge_unit byte records at offset of fd into edges
+void read_edge_records(int fd, long offset, long bytes, int edge_unit, std::vector<BlockEdge> &edges)
+{
+	long count = bytes / edge_unit;
+	char *raw = (char *)malloc(bytes + 1);
+	for (long done = 0; done < bytes;)
+	{
+		long read_bytes = pread(fd, raw + done, bytes - done, offset + done);
+		assert(read_bytes > 0);
+		done += read_bytes;
+	}
+	edges.resize(count);
+	for (long k = 0; k < count; k++)
+	{
+		edges[k].source = *(VertexId *)(raw + k * edge_unit);
+		edges[k].target = *(VertexId *)(raw + k * edge_unit + sizeof(VertexId));
+		edges[k].payload = 0;
+		memcpy(&edges[k].payload, raw + k * edge_unit + sizeof(VertexId) * 2, edge_unit - sizeof(VertexId) * 2);
+	}
+	free(raw);
+}
+
+void write_edge_records(int fd, long offset, int edge_unit, std::vector<BlockEdge> &edges)
+{
+	long bytes = edges.size() * edge_unit;
+	char *raw = (char *)malloc(bytes + 1);
+	for (size_t k = 0; k < edges.size(); k++)
+	{
+		memcpy(raw + k * edge_unit, &edges[k], edge_unit);
+	}
+	for (long done = 0; done < bytes;)
+	{
+		long write_bytes = pwrite(fd, raw + done, bytes - done, offset + done);
+		assert(write_bytes > 0);
+		done += write_bytes;
+	}
+	free(raw);
+}
+
+// load a block file of edge_unit byte records into edges
+void read_edge_block(const char *filename, int edge_unit, std::vector<BlockEdge> &edges)
+{
+	int fin = open(filename, O_RDONLY);
+	read_edge_records(fin, 0, file_size(filename), edge_unit, edges);
+	close(fin);
+}
+
+void write_edge_block(const char *filename, int edge_unit, std::vector<BlockEdge> &edges)
+{
+	int fout = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	write_edge_records(fout, 0, edge_unit, edges);
+	close(fout);
+}
+
+enum SortKey
+{
+	SORT_NONE,
+	SORT_SOURCE,
+	SORT_TARGET
+};
+
+// vertices per sub-tile side such that the source and target values of a tile (up to 8 bytes each)
+// take half of the L2 cache
+VertexId default_tile_vertices()
+{
+	long l2_bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if (l2_bytes <= 0)
+		l2_bytes = L2_CACHE_BYTES;
+	return l2_bytes / 2 / (sizeof(double) * 2);
+}
+
+// size of the last-level cache, or of the L2 cache if there is no L3
+long last_level_cache_bytes()
+{
+	long bytes = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	if (bytes <= 0)
+		bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if (bytes <= 0)
+		bytes = LLC_CACHE_BYTES;
+	return bytes;
+}
+
+// choose the grid dimension for a graph and print why; edges 0 means the edge count is unknown.
+// P is raised until a source and a target window of vertex_bytes per vertex fit in half of the
+// last-level cache and every hardware thread has a partition to update, but kept low enough that
+// blocks average MIN_BLOCK_BYTES of edges. It is then rounded up to a multiple of the windows that
+// the runtime splits the vertex data into when it exceeds 80% of memory_bytes (Graph::hint).
+int plan_partitions(VertexId vertices, EdgeId edges, int edge_unit, long memory_bytes, long vertex_bytes)
+{
+	long cache_bytes = last_level_cache_bytes();
+	long vertex_data_bytes = (long)vertices * vertex_bytes;
+	long threads = std::max(1u, std::thread::hardware_concurrency());
+	double MB = 1024.0 * 1024.0;
+
+	long cache_bound = (2 * vertex_data_bytes + cache_bytes / 2 - 1) / (cache_bytes / 2);
+	long block_bound = vertices;
+	if (edges > 0)
+	{
+		block_bound = std::max(std::min(block_bound, (long)sqrt((double)edges * edge_unit / MIN_BLOCK_BYTES)), 1l);
+	}
+	long windows = 1;
+	if (vertex_data_bytes > 0.8 * memory_bytes)
+	{
+		windows = (long)ceil(vertex_data_bytes / (0.8 * memory_bytes));
+	}
+	long partitions = std::max(std::min(std::max(cache_bound, threads), block_bound), 1l);
+	partitions = std::min((partitions + windows - 1) / windows * windows, (long)vertices);
+	partitions = std::max(partitions, 1l);
+
+	printf("grid plan for %d vertices and ", vertices);
+	if (edges > 0)
+		printf("%ld edges of %d bytes\n", edges, edge_unit);
+	else
+		printf("an unknown number of edges of %d bytes (pass -e to bound the block size)\n", edge_unit);
+	printf("  vertex data: %ld bytes per vertex, %.2f MB; memory budget %.2f GB\n", vertex_bytes, vertex_data_bytes / MB, memory_bytes / MB / 1024);
+	printf("  cache: P >= %ld keeps a source and a target window within half of the %.2f MB last-level cache\n", cache_bound, cache_bytes / MB);
+	printf("  threads: P >= %ld gives every hardware thread a partition to update\n", threads);
+	if (edges > 0)
+		printf("  blocks: P <= %ld keeps blocks at %.2f MB of edges or more on average\n", block_bound, MIN_BLOCK_BYTES / MB);
+	if (windows > 1)
+		printf("  memory: the vertex data exceeds 80%% of the budget and is updated in %ld windows, so P is a multiple of %ld\n", windows, windows);
+	else
+		printf("  memory: the vertex data fits in 80%% of the budget\n");
+	if (std::max(cache_bound, threads) > block_bound && partitions <= block_bound)
+		printf("  the cache and thread bounds are capped to avoid small blocks\n");
+	printf("  P = %ld: %ld blocks", partitions, partitions * partitions);
+	if (edges > 0)
+		printf(" of %.2f MB", (double)edges * edge_unit / (partitions * partitions) / MB);
+	printf(", windows of %.2f MB\n", (double)vertex_data_bytes / partitions / MB);
+	return partitions;
+}
+
+// sort the edges of block (i, j) by sub-tile, (tile_vertices by tile_vertices squares, visited in
+// source or target major order), then by (source, target) or (target, source) within a tile;
+// tile_vertices 0 leaves the block as a single tile
+void sort_block_edges(std::vector<BlockEdge> &edges, int sort_key, VertexId tile_vertices, VertexId source_base, VertexId target_base)
+{
+	auto tile = [&](VertexId v, VertexId base) {
+		return tile_vertices > 0 ? (v - base) / tile_vertices : 0;
+	};
+	if (sort_key == SORT_TARGET)
+	{
+		std::sort(edges.begin(), edges.end(), [&](const BlockEdge &a, const BlockEdge &b) {
+			return std::make_tuple(tile(a.target, target_base), tile(a.source, source_base), a.target, a.source) < std::make_tuple(tile(b.target, target_base), tile(b.source, source_base), b.target, b.source);
+		});
+	}
+	else
+	{
+		std::sort(edges.begin(), edges.end(), [&](const BlockEdge &a, const BlockEdge &b) {
+			return std::make_tuple(tile(a.source, source_base), tile(a.target, target_base), a.source, a.target) < std::make_tuple(tile(b.source, source_base), tile(b.target, target_base), b.source, b.target);
+		});
+	}
+}
+
+// sort the edges of every block file in place
+void sort_edge_blocks(std::string output, int partitions, const VertexId *bounds, int edge_unit, int sort_key, VertexId tile_vertices)
+{
+	int parallelism = std::thread::hardware_concurrency();
+	#pragma omp parallel for schedule(dynamic) num_threads(parallelism)
+	for (int ij = 0; ij < partitions * partitions; ij++)
+	{
+		int i = ij / partitions;
+		int j = ij % partitions;
+		char filename[4096];
+		sprintf(filename, "%s/block-%d-%d", output.c_str(), i, j);
+		std::vector<BlockEdge> edges;
+		read_edge_block(filename, edge_unit, edges);
+		sort_block_edges(edges, sort_key, tile_vertices, get_partition_range(bounds, partitions, i).first, get_partition_range(bounds, partitions, j).first);
+		write_edge_block(filename, edge_unit, edges);
+	}
+}
+
+// sort the edges of every block by (source, target), sub-tile first, and encode them into frames
+// (block-i-j.z), remembering the padded size of each frame
+void compress_edge_blocks(std::string output, int partitions, const VertexId *bounds, int edge_unit, VertexId tile_vertices, std::vector<std::vector<long>> &frame_bytes)
+{
+	int parallelism = std::thread::hardware_concurrency();
+	int payload_bytes = edge_unit - sizeof(VertexId) * 2;
+	frame_bytes.assign(partitions * partitions, std::vector<long>());
+	#pragma omp parallel for schedule(dynamic) num_threads(parallelism)
+	for (int ij = 0; ij < partitions * partitions; ij++)
+	{
+		int i = ij / partitions;
+		int j = ij % partitions;
+		char filename[4096];
+		sprintf(filename, "%s/block-%d-%d", output.c_str(), i, j);
+		std::vector<BlockEdge> edges;
+		read_edge_block(filename, edge_unit, edges);
+		long count = edges.size();
+		VertexId source_base = get_partition_range(bounds, partitions, i).first;
+		VertexId target_base = get_partition_range(bounds, partitions, j).first;
+		sort_block_edges(edges, SORT_SOURCE, tile_vertices, source_base, target_base);
+
+		char *frame = (char *)memalign(PAGESIZE, frame_max_bytes(FRAME_EDGES, payload_bytes));
+		sprintf(filename, "%s/block-%d-%d.z", output.c_str(), i, j);
+		int fout = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		for (long begin = 0; begin < count; begin += FRAME_EDGES)
+		{
+			long frame_edges = std::min((long)FRAME_EDGES, count - begin);
+			long padded = encode_frame((char *)(edges.data() + begin), sizeof(BlockEdge), frame_edges, payload_bytes, source_base, target_base, frame);
+			assert(write(fout, frame, padded) == padded);
+			frame_bytes[ij].push_back(padded);
+		}
+		close(fout);
+		free(frame);
+	}
+}
+
+// record the smallest and largest source of every index_unit bytes of a grid file (of every
+// frame if the grid is compressed), so that stream_edges can skip units without active sources
+void generate_source_index(std::string filename, std::string index_filename, int edge_unit, long index_unit, bool compressed)
+{
+	long bytes = file_size(filename);
+	std::vector<VertexId> index;
+	int fin = open(filename.c_str(), O_RDONLY);
+	if (compressed)
+	{
+		std::vector<long> frame_offset(file_size(filename + "_frame_offset") / sizeof(long));
+		int fin_frames = open((filename + "_frame_offset").c_str(), O_RDONLY);
+		assert(read(fin_frames, frame_offset.data(), frame_offset.size() * sizeof(long)) == (long)(frame_offset.size() * sizeof(long)));
+		close(fin_frames);
+		char *frame = (char *)memalign(PAGESIZE, frame_max_bytes(FRAME_EDGES, edge_unit - sizeof(VertexId) * 2));
+		char *edges = (char *)malloc((long)FRAME_EDGES * edge_unit);
+		unsigned int *scratch = new unsigned int[FRAME_EDGES * 2];
+		for (size_t f = 0; f + 1 < frame_offset.size(); f++)
+		{
+			long length = frame_offset[f + 1] - frame_offset[f];
+			assert(pread(fin, frame, length, frame_offset[f]) == length);
+			long count = decode_frame(frame, edge_unit, scratch, edges);
+			// sources only ascend within a sub-tile
+			VertexId min_source = *(VertexId *)edges, max_source = min_source;
+			for (long k = 1; k < count; k++)
+			{
+				VertexId source = *(VertexId *)(edges + k * edge_unit);
+				min_source = std::min(min_source, source);
+				max_source = std::max(max_source, source);
+			}
+			index.push_back(min_source);
+			index.push_back(max_source);
+		}
+		free(frame);
+		free(edges);
+		delete[] scratch;
+	}
+	else
+	{
+		char *buffer = (char *)memalign(PAGESIZE, IOSIZE);
+		for (long offset = 0; offset < bytes; offset += IOSIZE)
+		{
+			long length = pread(fin, buffer, IOSIZE, offset);
+			assert(length > 0);
+			for (long unit = 0; unit < length; unit += index_unit)
+			{
+				VertexId min_source = -1, max_source = -1;
+				for (long pos = unit; pos < unit + index_unit && pos + edge_unit <= length; pos += edge_unit)
+				{
+					VertexId source = *(VertexId *)(buffer + pos);
+					if (source == -1) // padding between the blocks of a single copy grid
+						continue;
+					if (min_source == -1 || source < min_source)
+						min_source = source;
+					if (source > max_source)
+						max_source = source;
+				}
+				index.push_back(min_source);
+				index.push_back(max_source);
+			}
+		}
+		free(buffer);
+	}
+	close(fin);
+	int fout = open(index_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	assert(write(fout, index.data(), index.size() * sizeof(VertexId)) == (long)(index.size() * sizeof(VertexId)));
+	close(fout);
+}
+
+enum VertexOrder
+{
+	ORDER_NONE,
+	ORDER_COMPACT,
+	ORDER_DEGREE,
+	ORDER_HUB,
+	ORDER_RCM,
+	VERTEX_ORDERS
+};
+
+const char *vertex_order_names[VERTEX_ORDERS] = {"none", "compact", "degree", "hub", "rcm"};
+
+int parse_vertex_order(const char *name)
+{
+	for (int order = 0; order < VERTEX_ORDERS; order++)
+	{
+		if (strcmp(name, vertex_order_names[order]) == 0)
+			return order;
+	}
+	return -1;
+}
+
+// call process(records, count, offset) on every chunk of the edge list, in parallel
+template <typename F>
+void scan_edge_list(std::string input, int edge_unit, F process)
+{
+	int parallelism = std::thread::hardware_concurrency();
+	long chunk = IOSIZE / edge_unit * edge_unit;
+	long bytes = file_size(input);
+	long chunks = (bytes + chunk - 1) / chunk;
+	int fin = open(input.c_str(), O_RDONLY);
+	assert(fin != -1);
+	#pragma omp parallel num_threads(parallelism)
+	{
+		char *buffer = (char *)memalign(PAGESIZE, chunk);
+		#pragma omp for schedule(dynamic)
+		for (long k = 0; k < chunks; k++)
+		{
+			long length = std::min(chunk, bytes - k * chunk);
+			long got = 0;
+			while (got < length)
+			{
+				long ret = pread(fin, buffer + got, length - got, k * chunk + got);
+				assert(ret > 0);
+				got += ret;
+			}
+			process(buffer, length / edge_unit, k * chunk);
+		}
+		free(buffer);
+	}
+	close(fin);
+}
+
+// reverse Cuthill-McKee over the undirected graph: breadth-first from a lowest degree vertex of
+// every component, neighbors visited in increasing degree, and the whole order reversed
+void order_rcm(std::string input, int edge_unit, VertexId vertices, std::vector<int> &degree, std::vector<VertexId> &order)
+{
+	int parallelism = std::thread::hardware_concurrency();
+	std::vector<long> offset(vertices + 1, 0);
+	for (VertexId v = 0; v < vertices; v++)
+	{
+		offset[v + 1] = offset[v] + degree[v];
+	}
+	std::vector<long> cursor(offset.begin(), offset.end() - 1);
+	std::vector<VertexId> neighbors(offset[vertices]);
+	scan_edge_list(input, edge_unit, [&](char *records, long count, long) {
+		for (long k = 0; k < count; k++)
+		{
+			VertexId source = *(VertexId *)(records + k * edge_unit);
+			VertexId target = *(VertexId *)(records + k * edge_unit + sizeof(VertexId));
+			neighbors[__sync_fetch_and_add(&cursor[source], 1)] = target;
+			neighbors[__sync_fetch_and_add(&cursor[target], 1)] = source;
+		}
+	});
+	#pragma omp parallel for schedule(dynamic, 4096) num_threads(parallelism)
+	for (VertexId v = 0; v < vertices; v++)
+	{
+		std::sort(neighbors.begin() + offset[v], neighbors.begin() + offset[v + 1], [&](VertexId a, VertexId b) {
+			return degree[a] < degree[b] || (degree[a] == degree[b] && a < b);
+		});
+	}
+
+	std::vector<VertexId> roots(order);
+	std::stable_sort(roots.begin(), roots.end(), [&](VertexId a, VertexId b) {
+		return degree[a] < degree[b];
+	});
+	std::vector<bool> visited(vertices, false);
+	order.clear();
+	for (VertexId root : roots)
+	{
+		if (visited[root])
+			continue;
+		visited[root] = true;
+		size_t head = order.size();
+		order.push_back(root);
+		while (head < order.size())
+		{
+			VertexId v = order[head++];
+			for (long k = offset[v]; k < offset[v + 1]; k++)
+			{
+				VertexId u = neighbors[k];
+				if (!visited[u])
+				{
+					visited[u] = true;
+					order.push_back(u);
+				}
+			}
+		}
+	}
+	std::reverse(order.begin(), order.end());
+}
+
+// relabel the vertices that have edges with the dense ids [0, new vertices) in the given order;
+// new_id[old id] is -1 for ids without edges; returns the old id of every new id
+std::vector<VertexId> generate_vertex_order(std::string input, int edge_unit, VertexId vertices, int vertex_order, std::vector<VertexId> &new_id)
+{
+	double start_time = get_time();
+	std::vector<int> degree(vertices, 0);
+	scan_edge_list(input, edge_unit, [&](char *records, long count, long) {
+		for (long k = 0; k < count; k++)
+		{
+			VertexId source = *(VertexId *)(records + k * edge_unit);
+			VertexId target = *(VertexId *)(records + k * edge_unit + sizeof(VertexId));
+			if (source < 0 || source >= vertices || target < 0 || target >= vertices)
+			{
+				fprintf(stderr, "edge (%d, %d) is out of the vertex range [0, %d).\n", source, target, vertices);
+				exit(-1);
+			}
+			write_add(&degree[source], 1);
+			write_add(&degree[target], 1);
+		}
+	});
+
+	// compact: the vertices with edges, in input order
+	std::vector<VertexId> order;
+	long total_degree = 0;
+	for (VertexId v = 0; v < vertices; v++)
+	{
+		if (degree[v] > 0)
+		{
+			order.push_back(v);
+			total_degree += degree[v];
+		}
+	}
+	switch (vertex_order)
+	{
+	case ORDER_DEGREE:
+		std::stable_sort(order.begin(), order.end(), [&](VertexId a, VertexId b) {
+			return degree[a] > degree[b];
+		});
 		break;
-	case 1:
-		edge_unit = sizeof(VertexId) * 2 + sizeof(Weight);
-		edges = file_size(input) / edge_unit;
+	case ORDER_HUB:
+	{
+		// hub clustering: vertices of above average degree first, both groups kept in input order
+		double average = order.empty() ? 0 : (double)total_degree / order.size();
+		std::stable_partition(order.begin(), order.end(), [&](VertexId v) {
+			return degree[v] > average;
+		});
+		break;
+	}
+	case ORDER_RCM:
+		order_rcm(input, edge_unit, vertices, degree, order);
 		break;
-	default:
-		fprintf(stderr, "edge type (%d) is not supported.\n", edge_type);
-		exit(-1);
 	}
-	printf("vertices = %d, edges = %ld\n", vertices, edges);
+
+	new_id.assign(vertices, -1);
+	for (VertexId v = 0; v < (VertexId)order.size(); v++)
+	{
+		new_id[order[v]] = v;
+	}
+	printf("relabeled %ld of %d vertex ids in %s order\n", order.size(), vertices, vertex_order_names[vertex_order]);
+	printf("it takes %.2f seconds to order vertices\n", get_time() - start_time);
+	return order;
+}
+
+// partition boundaries that give every partition about the same number of edge endpoints (out plus
+// in degree), so that the rows and the columns of the grid hold similar numbers of edges
+std::vector<VertexId> degree_partition_bounds(std::string input, int edge_unit, VertexId vertices, int partitions, const VertexId *new_id)
+{
+	double start_time = get_time();
+	std::vector<int> degree(vertices, 0);
+	scan_edge_list(input, edge_unit, [&](char *records, long count, long) {
+		for (long k = 0; k < count; k++)
+		{
+			VertexId source = *(VertexId *)(records + k * edge_unit);
+			VertexId target = *(VertexId *)(records + k * edge_unit + sizeof(VertexId));
+			if (new_id != NULL)
+			{
+				source = new_id[source];
+				target = new_id[target];
+			}
+			else if (source < 0 || source >= vertices || target < 0 || target >= vertices)
+			{
+				fprintf(stderr, "edge (%d, %d) is out of the vertex range [0, %d).\n", source, target, vertices);
+				exit(-1);
+			}
+			write_add(&degree[source], 1);
+			write_add(&degree[target], 1);
+		}
+	});
+	long total_degree = 0;
+	for (VertexId v = 0; v < vertices; v++)
+	{
+		total_degree += degree[v];
+	}
+	// partition i starts at the first vertex preceded by i / partitions of the endpoints
+	std::vector<VertexId> bounds(partitions + 1, vertices);
+	bounds[0] = 0;
+	long seen = 0;
+	int next = 1;
+	for (VertexId v = 0; v < vertices && next < partitions; v++)
+	{
+		while (next < partitions && seen >= total_degree * next / partitions)
+		{
+			bounds[next++] = v;
+		}
+		seen += degree[v];
+	}
+	printf("it takes %.2f seconds to balance partition boundaries\n", get_time() - start_time);
+	return bounds;
+}
+
+// new_to_old holds the old id of every new id, old_to_new the new id (or -1) of every old id
+void write_vertex_mapping(std::string output, std::vector<VertexId> &old_id, std::vector<VertexId> &new_id)
+{
+	int fout = open((output + "/new_to_old").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	assert(fout != -1);
+	long bytes = write(fout, old_id.data(), sizeof(VertexId) * old_id.size());
+	assert(bytes == (long)(sizeof(VertexId) * old_id.size()));
+	close(fout);
+	fout = open((output + "/old_to_new").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	assert(fout != -1);
+	bytes = write(fout, new_id.data(), sizeof(VertexId) * new_id.size());
+	assert(bytes == (long)(sizeof(VertexId) * new_id.size()));
+	close(fout);
+}
+
+// write the source index, if requested, and the meta file of a grid whose row and column files are complete
+void finish_edge_grid(std::string output, VertexId vertices, EdgeId edges, int partitions, const VertexId *bounds, int edge_format, bool compressed, bool indexed, bool single_copy, int sort_key, VertexId tile_vertices, int vertex_order)
+{
+	int edge_type = (edge_format == EDGE_UNWEIGHTED) ? 0 : 1;
+	int edge_unit = edge_format_unit(edge_format);
+	double start_time = get_time();
+	long index_unit = 0;
+	if (indexed)
+	{
+		index_unit = edge_page_size(edge_unit) * INDEX_PAGES;
+		generate_source_index(output + "/row", output + "/row_index", edge_unit, index_unit, compressed);
+		if (!single_copy)
+		{
+			generate_source_index(output + "/column", output + "/column_index", edge_unit, index_unit, compressed);
+		}
+		printf("it takes %.2f seconds to generate source index\n", get_time() - start_time);
+	}
+
+	FILE *fmeta = fopen((output + "/meta").c_str(), "w");
+	fprintf(fmeta, "%d %d %ld %d", edge_type, vertices, edges, partitions);
+	fprintf(fmeta, "\nformat %s", edge_format_name(edge_format));
+	if (compressed)
+	{
+		fprintf(fmeta, "\ncompressed 1");
+	}
+	if (indexed)
+	{
+		fprintf(fmeta, "\nindex_unit %ld", index_unit);
+	}
+	if (single_copy)
+	{
+		fprintf(fmeta, "\nlayout single");
+	}
+	if (sort_key != SORT_NONE)
+	{
+		fprintf(fmeta, "\nsort %s", sort_key == SORT_SOURCE ? "source" : "target");
+		fprintf(fmeta, "\ntile_vertices %d", tile_vertices);
+	}
+	if (vertex_order != ORDER_NONE)
+	{
+		fprintf(fmeta, "\norder %s", vertex_order_names[vertex_order]);
+	}
+	// non-uniform partition boundaries are stored as partitions + 1 ids in partition_bounds
+	if (std::vector<VertexId>(bounds, bounds + partitions + 1) != uniform_partition_bounds(vertices, partitions))
+	{
+		fprintf(fmeta, "\npartition degree");
+		int fbounds = open((output + "/partition_bounds").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		pwrite_all(fbounds, (const char *)bounds, sizeof(VertexId) * (partitions + 1), 0);
+		close(fbounds);
+	}
+	fclose(fmeta);
+}
+
+// new_id, if given, relabels the input ids on the fly; input may be a pipe or stdin ("-"), holding
+// binary records or, if text is set, lines that the worker threads parse. A regular text file is
+// mapped and its line-aligned pieces are handed to the workers in place.
+void generate_edge_grid(std::string input, bool text, std::string output, VertexId vertices, int partitions, const VertexId *bounds, int edge_format, bool compressed, bool indexed, bool single_copy, int sort_key, VertexId tile_vertices, const VertexId *new_id, int vertex_order)
+{
+	int parallelism = std::thread::hardware_concurrency(); //返回硬件线程上下文的数量。
+	int edge_unit = edge_format_unit(edge_format);
+	int payload_bytes = edge_unit - sizeof(VertexId) * 2;
+	EdgeId edges = 0;
+	printf("vertices = %d\n", vertices);
 
 	char **buffers = new char *[parallelism * 2];
 	bool *occupied = new bool[parallelism * 2];
@@ -106,6 +858,21 @@ void generate_edge_grid(std::string input, std::string output, VertexId vertices
 		}
 	}
 
+	int fin = (input == "-") ? 0 : open(input.c_str(), O_RDONLY);
+	if (fin == -1)
+		printf("%s\n", strerror(errno));
+	assert(fin != -1);
+	long total_bytes = is_regular_file(input) ? file_size(input) : 0;
+	const char *mapped_text = NULL;
+	std::vector<long> pieces;
+	if (text && is_regular_file(input) && total_bytes > 0)
+	{
+		mapped_text = (const char *)mmap(NULL, total_bytes, PROT_READ, MAP_PRIVATE, fin, 0);
+		assert(mapped_text != MAP_FAILED);
+		madvise((void *)mapped_text, total_bytes, MADV_SEQUENTIAL);
+		pieces = split_text_lines(mapped_text, total_bytes);
+	}
+
 	std::vector<std::thread> threads;
 	for (int ti = 0; ti < parallelism; ti++)
 	{								 //多线程
@@ -116,10 +883,10 @@ void generate_edge_grid(std::string input, std::string output, VertexId vertices
 			//[bar]   截取bar变量并且拷贝一份在函数体重使用，同时不截取其他变量
 			//[this]            截取当前类中的this指针。如果已经使用了&或者=就默认添加此选项。
 			char *local_buffer = (char *)memalign(PAGESIZE, IOSIZE);
+			char *parse_buffer = text ? (char *)memalign(PAGESIZE, IOSIZE) : NULL;
 			int *local_grid_offset = new int[partitions * partitions]; //全局
 			int *local_grid_cursor = new int[partitions * partitions]; //局部
 			VertexId source, target;
-			Weight weight;
 			while (true)
 			{
 				int cursor;
@@ -130,13 +897,36 @@ void generate_edge_grid(std::string input, std::string output, VertexId vertices
 				memset(local_grid_offset, 0, sizeof(int) * partitions * partitions); //void *memset(void *s,int c,size_t n)
 				//总的作用：将已开辟内存空间 s 的首 n 个字节的值设为值 c。
 				memset(local_grid_cursor, 0, sizeof(int) * partitions * partitions);
-				char *buffer = buffers[cursor];
+				// in mapped mode the cursor is the index of a piece of the text
+				char *buffer = (mapped_text != NULL) ? (char *)mapped_text + pieces[cursor] : buffers[cursor];
+				if (text)
+				{
+					bytes = parse_edge_text(buffer, bytes, edge_format, parse_buffer);
+					buffer = parse_buffer;
+					if (mapped_text == NULL)
+						occupied[cursor] = false;
+				}
+				write_add(&edges, bytes / edge_unit);
+				if (new_id != NULL)
+				{
+					for (long pos = 0; pos < bytes; pos += edge_unit)
+					{
+						VertexId *ids = (VertexId *)(buffer + pos);
+						ids[0] = new_id[ids[0]];
+						ids[1] = new_id[ids[1]];
+					}
+				}
 				for (long pos = 0; pos < bytes; pos += edge_unit)
 				{ //计算网格位置
 					source = *(VertexId *)(buffer + pos);
 					target = *(VertexId *)(buffer + pos + sizeof(VertexId));
-					int i = get_partition_id(vertices, partitions, source);
-					int j = get_partition_id(vertices, partitions, target);
+					if (source < 0 || source >= vertices || target < 0 || target >= vertices)
+					{
+						fprintf(stderr, "edge (%d, %d) is out of the vertex range [0, %d).\n", source, target, vertices);
+						exit(-1);
+					}
+					int i = get_partition_id(bounds, partitions, source);
+					int j = get_partition_id(bounds, partitions, target);
 					local_grid_offset[i * partitions + j] += edge_unit;
 				}
 				local_grid_cursor[0] = 0;
@@ -150,15 +940,11 @@ void generate_edge_grid(std::string input, std::string output, VertexId vertices
 				{ //分段存储在local_buffer
 					source = *(VertexId *)(buffer + pos);
 					target = *(VertexId *)(buffer + pos + sizeof(VertexId));
-					int i = get_partition_id(vertices, partitions, source);
-					int j = get_partition_id(vertices, partitions, target);
+					int i = get_partition_id(bounds, partitions, source);
+					int j = get_partition_id(bounds, partitions, target);
 					*(VertexId *)(local_buffer + local_grid_cursor[i * partitions + j]) = source;
 					*(VertexId *)(local_buffer + local_grid_cursor[i * partitions + j] + sizeof(VertexId)) = target;
-					if (edge_type == 1)
-					{
-						weight = *(Weight *)(buffer + pos + sizeof(VertexId) * 2);
-						*(Weight *)(local_buffer + local_grid_cursor[i * partitions + j] + sizeof(VertexId) * 2) = weight;
-					}
+					memcpy(local_buffer + local_grid_cursor[i * partitions + j] + sizeof(VertexId) * 2, buffer + pos + sizeof(VertexId) * 2, payload_bytes);
 					local_grid_cursor[i * partitions + j] += edge_unit;
 				}
 				int start = 0;
@@ -184,32 +970,73 @@ void generate_edge_grid(std::string input, std::string output, VertexId vertices
 					}
 					start = local_grid_offset[ij];
 				}
-				occupied[cursor] = false;
+				if (!text)
+					occupied[cursor] = false;
 			}
+			free(parse_buffer);
 		});
 	}
 
-	int fin = open(input.c_str(), O_RDONLY);
-	if (fin == -1)
-		printf("%s\n", strerror(errno));
-	assert(fin != -1);
 	int cursor = 0;
-	long total_bytes = file_size(input);
 	long read_bytes = 0;
 	double start_time = get_time();
-	while (true)
+	for (long k = 0; k + 1 < (long)pieces.size(); k++)
 	{
-		long bytes = read(fin, buffers[cursor], IOSIZE); //ssize_t read( int filedes, void *buf, size_t nbytes);
-		//从 filedes 中读取数据到 buf 中，nbytes 是要求读到的字节数。
-		//返回值：若成功则返回实际读到的字节数，若已到文件尾则返回0，若出错则返回-1。
-		assert(bytes != -1); //现计算表达式 expression ，如果其值为假（即为0），那么它先向stderr打印一条出错信息，
-		//然后通过调用 abort 来终止程序运行。
-		if (bytes == 0)
-			break;
-		occupied[cursor] = true;
-		tasks.push(std::make_tuple(cursor, bytes));
-		read_bytes += bytes;
+		tasks.push(std::make_tuple((int)k, pieces[k + 1] - pieces[k]));
+		read_bytes = pieces[k + 1];
 		printf("progress: %.2f%%\r", 100. * read_bytes / total_bytes);
+		fflush(stdout);
+	}
+	// buffers are filled completely, as pipes return short reads; text is handed out up to the
+	// last line end and the partial line is carried over to the next buffer
+	long read_size = text ? TEXT_PIECE : IOSIZE;
+	std::vector<char> carry;
+	bool eof = (mapped_text != NULL);
+	while (!eof)
+	{
+		long bytes = carry.size();
+		memcpy(buffers[cursor], carry.data(), bytes);
+		carry.clear();
+		while (bytes < read_size)
+		{
+			long ret = read(fin, buffers[cursor] + bytes, read_size - bytes); //ssize_t read( int filedes, void *buf, size_t nbytes);
+			//从 filedes 中读取数据到 buf 中，nbytes 是要求读到的字节数。
+			//返回值：若成功则返回实际读到的字节数，若已到文件尾则返回0，若出错则返回-1。
+			assert(ret != -1); //现计算表达式 expression ，如果其值为假（即为0），那么它先向stderr打印一条出错信息，
+			//然后通过调用 abort 来终止程序运行。
+			if (ret == 0)
+			{
+				eof = true;
+				break;
+			}
+			bytes += ret;
+			read_bytes += ret;
+		}
+		long ready = bytes;
+		if (text && !eof)
+		{
+			char *eol = (char *)memrchr(buffers[cursor], '\n', bytes);
+			if (eol == NULL)
+			{
+				fprintf(stderr, "edge list line too long.\n");
+				exit(-1);
+			}
+			ready = eol - buffers[cursor] + 1;
+		}
+		else if (!text && bytes % edge_unit != 0)
+		{
+			fprintf(stderr, "the input ends with a partial edge.\n");
+			exit(-1);
+		}
+		carry.assign(buffers[cursor] + ready, buffers[cursor] + bytes);
+		if (ready == 0)
+			continue;
+		occupied[cursor] = true;
+		tasks.push(std::make_tuple(cursor, ready));
+		if (total_bytes > 0)
+			printf("progress: %.2f%%\r", 100. * read_bytes / total_bytes);
+		else
+			printf("progress: %ld bytes\r", read_bytes);
 		fflush(stdout); //在printf()后使用fflush(stdout)的作用是立刻将要输出的内容输出。
 		//当使用printf()函数后，系统将内容存入输出缓冲区，等到时间片轮转到系统的输出程序时，将其输出。
 		//使用fflush（out）后，立刻清空输出缓冲区，并把缓冲区内容输出。
@@ -218,9 +1045,6 @@ void generate_edge_grid(std::string input, std::string output, VertexId vertices
 			cursor = (cursor + 1) % (parallelism * 2);
 		}
 	}
-	close(fin);
-	assert(read_bytes == edges * edge_unit);
-
 	for (int ti = 0; ti < parallelism; ti++)
 	{
 		tasks.push(std::make_tuple(-1, 0));
@@ -230,6 +1054,13 @@ void generate_edge_grid(std::string input, std::string output, VertexId vertices
 	{
 		threads[ti].join();
 	}
+	if (mapped_text != NULL)
+		munmap((void *)mapped_text, total_bytes);
+	if (fin != 0)
+		close(fin);
+
+	total_bytes = edges * edge_unit;
+	printf("\nedges = %ld\n", edges);
 
 	printf("%lf -> ", get_time() - start_time);
 	long ts = 0;
@@ -256,38 +1087,75 @@ void generate_edge_grid(std::string input, std::string output, VertexId vertices
 
 	printf("it takes %.2f seconds to generate edge blocks\n", get_time() - start_time);
 
+	std::vector<std::vector<long>> frame_bytes;
+	const char *block_name = "%s/block-%d-%d";
+	if (compressed)
+	{
+		compress_edge_blocks(output, partitions, bounds, edge_unit, tile_vertices, frame_bytes);
+		block_name = "%s/block-%d-%d.z";
+		printf("it takes %.2f seconds to compress edge blocks\n", get_time() - start_time);
+	}
+	else if (sort_key != SORT_NONE)
+	{
+		sort_edge_blocks(output, partitions, bounds, edge_unit, sort_key, tile_vertices);
+		printf("it takes %.2f seconds to sort edge blocks\n", get_time() - start_time);
+	}
+
 	long offset; //按列写，每一列的偏移量
-	int fout_column = open((output + "/column").c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
-	int fout_column_offset = open((output + "/column_offset").c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
-	offset = 0;
-	for (int j = 0; j < partitions; j++)
+	long page_bytes = edge_page_size(edge_unit);
+	std::vector<char> padding(page_bytes, (char)0xff);
+	std::vector<long> block_bytes;
+	// a single copy grid is read in column order from the row file
+	if (!single_copy)
 	{
-		for (int i = 0; i < partitions; i++)
+		int fout_column = open((output + "/column").c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+		int fout_column_offset = open((output + "/column_offset").c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+		int fout_column_frames = compressed ? open((output + "/column_frame_offset").c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644) : -1;
+		offset = 0;
+		for (int j = 0; j < partitions; j++)
 		{
-			printf("progress: %.2f%%\r", 100. * offset / total_bytes);
-			fflush(stdout);
-			write(fout_column_offset, &offset, sizeof(offset));
-			char filename[4096];
-			sprintf(filename, "%s/block-%d-%d", output.c_str(), i, j);
-			offset += file_size(filename);
-			fin = open(filename, O_RDONLY);
-			while (true)
+			for (int i = 0; i < partitions; i++)
 			{
-				long bytes = read(fin, buffers[0], IOSIZE);
-				assert(bytes != -1);
-				if (bytes == 0)
-					break;
-				write(fout_column, buffers[0], bytes);
+				printf("progress: %.2f%%\r", 100. * offset / total_bytes);
+				fflush(stdout);
+				write(fout_column_offset, &offset, sizeof(offset));
+				char filename[4096];
+				sprintf(filename, block_name, output.c_str(), i, j);
+				if (compressed)
+				{
+					long frame_offset = offset;
+					for (long bytes : frame_bytes[i * partitions + j])
+					{
+						write(fout_column_frames, &frame_offset, sizeof(frame_offset));
+						frame_offset += bytes;
+					}
+				}
+				offset += file_size(filename);
+				fin = open(filename, O_RDONLY);
+				while (true)
+				{
+					long bytes = read(fin, buffers[0], IOSIZE);
+					assert(bytes != -1);
+					if (bytes == 0)
+						break;
+					write(fout_column, buffers[0], bytes);
+				}
+				close(fin);
 			}
-			close(fin);
 		}
+		write(fout_column_offset, &offset, sizeof(offset));
+		close(fout_column_offset);
+		close(fout_column);
+		if (compressed)
+		{
+			write(fout_column_frames, &offset, sizeof(offset));
+			close(fout_column_frames);
+		}
+		printf("column oriented grid generated\n");
 	}
-	write(fout_column_offset, &offset, sizeof(offset));
-	close(fout_column_offset);
-	close(fout_column);
-	printf("column oriented grid generated\n");
 	int fout_row = open((output + "/row").c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
 	int fout_row_offset = open((output + "/row_offset").c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+	int fout_row_frames = compressed ? open((output + "/row_frame_offset").c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644) : -1;
 	offset = 0; //每一列的偏移量
 	for (int i = 0; i < partitions; i++)
 	{ //按行写
@@ -297,8 +1165,18 @@ void generate_edge_grid(std::string input, std::string output, VertexId vertices
 			fflush(stdout);
 			write(fout_row_offset, &offset, sizeof(offset));
 			char filename[4096];
-			sprintf(filename, "%s/block-%d-%d", output.c_str(), i, j);
+			sprintf(filename, block_name, output.c_str(), i, j);
+			if (compressed)
+			{
+				long frame_offset = offset;
+				for (long bytes : frame_bytes[i * partitions + j])
+				{
+					write(fout_row_frames, &frame_offset, sizeof(frame_offset));
+					frame_offset += bytes;
+				}
+			}
 			offset += file_size(filename);
+			block_bytes.push_back(file_size(filename));
 			fin = open(filename, O_RDONLY);
 			while (true)
 			{
@@ -309,18 +1187,209 @@ void generate_edge_grid(std::string input, std::string output, VertexId vertices
 				write(fout_row, buffers[0], bytes);
 			}
 			close(fin);
+			if (single_copy && !compressed && offset % page_bytes != 0)
+			{
+				// start every block on a page, so that it can be read alone in any order
+				long pad_bytes = page_bytes - offset % page_bytes;
+				write(fout_row, padding.data(), pad_bytes);
+				offset += pad_bytes;
+			}
 		}
 	}
 	write(fout_row_offset, &offset, sizeof(offset));
 	close(fout_row_offset);
 	close(fout_row);
+	if (compressed)
+	{
+		write(fout_row_frames, &offset, sizeof(offset));
+		close(fout_row_frames);
+		printf("compressed %ld bytes of edges into %ld bytes\n", total_bytes, offset);
+	}
 	printf("row oriented grid generated\n");
+	if (single_copy)
+	{
+		int fout_block_bytes = open((output + "/block_bytes").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		pwrite_all(fout_block_bytes, (char *)block_bytes.data(), sizeof(long) * block_bytes.size(), 0);
+		close(fout_block_bytes);
+	}
+	for (int i = 0; i < partitions; i++)
+	{
+		for (int j = 0; j < partitions; j++)
+		{
+			char filename[4096];
+			sprintf(filename, "%s/block-%d-%d", output.c_str(), i, j);
+			unlink(filename);
+			if (compressed)
+			{
+				sprintf(filename, "%s/block-%d-%d.z", output.c_str(), i, j);
+				unlink(filename);
+			}
+		}
+	}
 
 	printf("it takes %.2f seconds to generate edge grid\n", get_time() - start_time);
 
-	FILE *fmeta = fopen((output + "/meta").c_str(), "w");
-	fprintf(fmeta, "%d %d %ld %d", edge_type, vertices, edges, partitions);
-	fclose(fmeta);
+	finish_edge_grid(output, vertices, edges, partitions, bounds, edge_format, compressed, indexed, single_copy, sort_key, tile_vertices, vertex_order);
+}
+
+// build the row and column files without block files: a counting pass sizes every block, then
+// every chunk of the edge list is bucketed by block and each bucket is written with pwrite to the
+// next free position of its block in both files (only in row, page aligned, for a single copy)
+void generate_edge_grid_direct(std::string input, std::string output, VertexId vertices, int partitions, const VertexId *bounds, int edge_format, bool indexed, bool single_copy, int sort_key, VertexId tile_vertices, const VertexId *new_id, int vertex_order)
+{
+	int edge_unit = edge_format_unit(edge_format);
+	int blocks = partitions * partitions;
+	EdgeId edges = file_size(input) / edge_unit;
+	printf("vertices = %d, edges = %ld\n", vertices, edges);
+	if (file_exists(output))
+	{
+		remove_directory(output);
+	}
+	create_directory(output);
+	double start_time = get_time();
+
+	auto relabel = [&](char *records, long count) {
+		for (long k = 0; k < count && new_id != NULL; k++)
+		{
+			VertexId *ids = (VertexId *)(records + k * edge_unit);
+			ids[0] = new_id[ids[0]];
+			ids[1] = new_id[ids[1]];
+		}
+	};
+	auto block_of = [&](char *record) {
+		VertexId source = *(VertexId *)record;
+		VertexId target = *(VertexId *)(record + sizeof(VertexId));
+		return get_partition_id(bounds, partitions, source) * partitions + get_partition_id(bounds, partitions, target);
+	};
+
+	std::vector<long> block_bytes(blocks, 0);
+	scan_edge_list(input, edge_unit, [&](char *records, long count, long) {
+		relabel(records, count);
+		std::vector<long> local_bytes(blocks, 0);
+		for (long k = 0; k < count; k++)
+		{
+			VertexId source = *(VertexId *)(records + k * edge_unit);
+			VertexId target = *(VertexId *)(records + k * edge_unit + sizeof(VertexId));
+			if (source < 0 || source >= vertices || target < 0 || target >= vertices)
+			{
+				fprintf(stderr, "edge (%d, %d) is out of the vertex range [0, %d).\n", source, target, vertices);
+				exit(-1);
+			}
+			local_bytes[block_of(records + k * edge_unit)] += edge_unit;
+		}
+		for (int ij = 0; ij < blocks; ij++)
+		{
+			if (local_bytes[ij] > 0)
+				write_add(&block_bytes[ij], local_bytes[ij]);
+		}
+	});
+	printf("it takes %.2f seconds to count edge blocks\n", get_time() - start_time);
+
+	// offsets of block (i, j) in the row file (row-major) and in the column file (column-major)
+	long page_bytes = edge_page_size(edge_unit);
+	std::vector<long> row_offset(blocks + 1, 0), column_offset(blocks + 1, 0), column_position(blocks, 0);
+	for (int ij = 0; ij < blocks; ij++)
+	{
+		row_offset[ij + 1] = row_offset[ij] + block_bytes[ij];
+		if (single_copy)
+		{
+			row_offset[ij + 1] = (row_offset[ij + 1] + page_bytes - 1) / page_bytes * page_bytes;
+		}
+	}
+	for (int j = 0; j < partitions; j++)
+	{
+		for (int i = 0; i < partitions; i++)
+		{
+			int ji = j * partitions + i;
+			column_position[i * partitions + j] = column_offset[ji];
+			column_offset[ji + 1] = column_offset[ji] + block_bytes[i * partitions + j];
+		}
+	}
+	int fout_row_offset = open((output + "/row_offset").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	pwrite_all(fout_row_offset, (char *)row_offset.data(), sizeof(long) * (blocks + 1), 0);
+	close(fout_row_offset);
+	int fout_row = open((output + "/row").c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	assert(fout_row != -1);
+	assert(ftruncate(fout_row, row_offset[blocks]) == 0);
+	int fout_column = -1;
+	if (single_copy)
+	{
+		int fout_block_bytes = open((output + "/block_bytes").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		pwrite_all(fout_block_bytes, (char *)block_bytes.data(), sizeof(long) * blocks, 0);
+		close(fout_block_bytes);
+		std::vector<char> padding(page_bytes, (char)0xff);
+		for (int ij = 0; ij < blocks; ij++)
+		{
+			long block_end = row_offset[ij] + block_bytes[ij];
+			pwrite_all(fout_row, padding.data(), row_offset[ij + 1] - block_end, block_end);
+		}
+	}
+	else
+	{
+		int fout_column_offset = open((output + "/column_offset").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		pwrite_all(fout_column_offset, (char *)column_offset.data(), sizeof(long) * (blocks + 1), 0);
+		close(fout_column_offset);
+		fout_column = open((output + "/column").c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		assert(fout_column != -1);
+		assert(ftruncate(fout_column, row_offset[blocks]) == 0);
+	}
+	std::vector<long> block_cursor(blocks, 0);
+	scan_edge_list(input, edge_unit, [&](char *records, long count, long) {
+		relabel(records, count);
+		std::vector<long> local_offset(blocks + 1, 0);
+		for (long k = 0; k < count; k++)
+		{
+			local_offset[block_of(records + k * edge_unit) + 1] += edge_unit;
+		}
+		for (int ij = 0; ij < blocks; ij++)
+		{
+			local_offset[ij + 1] += local_offset[ij];
+		}
+		std::vector<long> local_cursor(local_offset.begin(), local_offset.end() - 1);
+		char *local_buffer = (char *)memalign(PAGESIZE, count * edge_unit);
+		for (long k = 0; k < count; k++)
+		{
+			int ij = block_of(records + k * edge_unit);
+			memcpy(local_buffer + local_cursor[ij], records + k * edge_unit, edge_unit);
+			local_cursor[ij] += edge_unit;
+		}
+		for (int ij = 0; ij < blocks; ij++)
+		{
+			long bytes = local_offset[ij + 1] - local_offset[ij];
+			if (bytes == 0)
+				continue;
+			long position = __sync_fetch_and_add(&block_cursor[ij], bytes);
+			pwrite_all(fout_row, local_buffer + local_offset[ij], bytes, row_offset[ij] + position);
+			if (fout_column != -1)
+				pwrite_all(fout_column, local_buffer + local_offset[ij], bytes, column_position[ij] + position);
+		}
+		free(local_buffer);
+	});
+	printf("it takes %.2f seconds to scatter edges\n", get_time() - start_time);
+
+	if (sort_key != SORT_NONE)
+	{
+		int parallelism = std::thread::hardware_concurrency();
+		#pragma omp parallel for schedule(dynamic) num_threads(parallelism)
+		for (int ij = 0; ij < blocks; ij++)
+		{
+			int i = ij / partitions;
+			int j = ij % partitions;
+			std::vector<BlockEdge> block_edges;
+			read_edge_records(fout_row, row_offset[ij], block_bytes[ij], edge_unit, block_edges);
+			sort_block_edges(block_edges, sort_key, tile_vertices, get_partition_range(bounds, partitions, i).first, get_partition_range(bounds, partitions, j).first);
+			write_edge_records(fout_row, row_offset[ij], edge_unit, block_edges);
+			if (fout_column != -1)
+				write_edge_records(fout_column, column_position[ij], edge_unit, block_edges);
+		}
+		printf("it takes %.2f seconds to sort edge blocks\n", get_time() - start_time);
+	}
+	close(fout_row);
+	if (fout_column != -1)
+		close(fout_column);
+	printf("it takes %.2f seconds to generate edge grid\n", get_time() - start_time);
+
+	finish_edge_grid(output, vertices, edges, partitions, bounds, edge_format, false, indexed, single_copy, sort_key, tile_vertices, vertex_order);
 }
 
 int main(int argc, char **argv)
@@ -330,8 +1399,21 @@ int main(int argc, char **argv)
 	std::string output = "";
 	VertexId vertices = -1;
 	int partitions = -1;
-	int edge_type = 0;
-	while ((opt = getopt(argc, argv, "i:o:v:p:t:")) != -1)
+	int edge_format = EDGE_UNWEIGHTED;
+	bool compressed = false;
+	bool indexed = false;
+	int vertex_order = ORDER_NONE;
+	bool direct = false;
+	bool single_copy = false;
+	bool text = false;
+	int sort_key = SORT_NONE;
+	VertexId tile_vertices = -1;
+	bool balanced = false;
+	bool dry_run = false;
+	EdgeId edges = 0;
+	long memory_bytes = 8l * 1024l * 1024l * 1024l;
+	long vertex_bytes = sizeof(VertexId) + sizeof(float) * 2;
+	while ((opt = getopt(argc, argv, "i:o:v:p:t:cxr:s:l:duf:ne:m:b:g:")) != -1)
 	{
 		switch (opt)
 		{
@@ -348,19 +1430,180 @@ int main(int argc, char **argv)
 			partitions = atoi(optarg);
 			break;
 		case 't':
-			edge_type = atoi(optarg);
+			// 0 and 1 are the unweighted and float weighted formats
+			if (strcmp(optarg, "0") == 0 || strcmp(optarg, "1") == 0)
+			{
+				edge_format = atoi(optarg);
+			}
+			else
+			{
+				edge_format = parse_edge_format(optarg);
+			}
+			if (edge_format == -1)
+			{
+				fprintf(stderr, "edge type (%s) is not supported.\n", optarg);
+				exit(-1);
+			}
+			break;
+		case 'c':
+			compressed = true;
+			break;
+		case 'x':
+			indexed = true;
+			break;
+		case 'd':
+			direct = true;
+			break;
+		case 'u':
+			single_copy = true;
+			break;
+		case 'f':
+			if (strcmp(optarg, "text") == 0 || strcmp(optarg, "binary") == 0)
+			{
+				text = (strcmp(optarg, "text") == 0);
+			}
+			else
+			{
+				fprintf(stderr, "input format (%s) is not supported.\n", optarg);
+				exit(-1);
+			}
+			break;
+		case 's':
+			if (strcmp(optarg, "source") == 0)
+			{
+				sort_key = SORT_SOURCE;
+			}
+			else if (strcmp(optarg, "target") == 0)
+			{
+				sort_key = SORT_TARGET;
+			}
+			else
+			{
+				fprintf(stderr, "sort key (%s) is not supported.\n", optarg);
+				exit(-1);
+			}
+			break;
+		case 'l':
+			tile_vertices = atoi(optarg);
+			break;
+		case 'g':
+			if (strcmp(optarg, "degree") == 0 || strcmp(optarg, "uniform") == 0)
+			{
+				balanced = (strcmp(optarg, "degree") == 0);
+			}
+			else
+			{
+				fprintf(stderr, "partition boundaries (%s) are not supported.\n", optarg);
+				exit(-1);
+			}
+			break;
+		case 'n':
+			dry_run = true;
+			break;
+		case 'e':
+			edges = atol(optarg);
+			break;
+		case 'm':
+			memory_bytes = atof(optarg) * 1024 * 1024 * 1024;
+			break;
+		case 'b':
+			vertex_bytes = atol(optarg);
+			break;
+		case 'r':
+			vertex_order = parse_vertex_order(optarg);
+			if (vertex_order == -1)
+			{
+				fprintf(stderr, "vertex order (%s) is not supported.\n", optarg);
+				exit(-1);
+			}
 			break;
 		}
 	}
-	if (input == "" || output == "" || vertices == -1)
+	if ((dry_run ? (input == "" && edges == 0) : (input == "" || output == "")) || vertices == -1)
 	{
-		fprintf(stderr, "usage: %s -i [input path] -o [output path] -v [vertices] -p [partitions] -t [edge type: 0=unweighted, 1=weighted]\n", argv[0]);
+		fprintf(stderr, "usage: %s -i [input path, - for stdin] -o [output path] -v [vertices] -p [partitions, planned if omitted] -t [edge type: 0=unweighted, 1=weighted, or a format: unweighted, float, double, int, timestamp, label] [-c: compress edge blocks] [-x: index block sources] [-r: relabel vertices in order none, compact, degree, hub or rcm] [-s: sort blocks by source or target] [-l: sub-tile vertices, 0 for none] [-d: write row and column directly, without block files] [-u: store a single copy of the grid] [-f: input format, binary or text] [-g: partition boundaries, uniform or degree] [-n: only print the grid plan] [-e: edges, for the plan] [-m: memory budget in GB, for the plan] [-b: vertex data bytes per vertex, for the plan]\n", argv[0]);
 		exit(-1);
 	}
+	int edge_unit = edge_format_unit(edge_format);
+	if (edges == 0 && !text && is_regular_file(input))
+	{
+		edges = file_size(input) / edge_unit;
+	}
+	if (dry_run)
+	{
+		plan_partitions(vertices, edges, edge_unit, memory_bytes, vertex_bytes);
+		return 0;
+	}
+	if (direct && compressed)
+	{
+		fprintf(stderr, "compressed grids are built from block files (-d and -c cannot be combined).\n");
+		exit(-1);
+	}
+	if (sort_key == SORT_TARGET && (compressed || indexed))
+	{
+		fprintf(stderr, "compressed and indexed grids are sorted by source.\n");
+		exit(-1);
+	}
+	if (tile_vertices == -1)
+	{
+		// explicitly sorted blocks are sub-tiled for the L2 cache by default
+		tile_vertices = (sort_key != SORT_NONE) ? default_tile_vertices() : 0;
+	}
+	if (sort_key == SORT_NONE && (compressed || indexed))
+	{
+		sort_key = SORT_SOURCE;
+	}
+	// streams and text files are scattered as they are read and parsed unless the input has to be
+	// read more than once; then streams are spooled and text is parsed in parallel into a binary edge
+	// list first. Temporary inputs sit next to output
+	std::vector<std::string> temporaries;
+	if (!is_regular_file(input) && (direct || balanced || vertex_order != ORDER_NONE))
+	{
+		temporaries.push_back(output + ".input");
+		spool_input(input, temporaries.back());
+		input = temporaries.back();
+	}
+	if (text && is_regular_file(input) && (direct || balanced || vertex_order != ORDER_NONE))
+	{
+		temporaries.push_back(output + ".edges");
+		convert_edge_text(input, temporaries.back(), edge_format);
+		input = temporaries.back();
+		text = false;
+	}
+	std::vector<VertexId> old_id, new_id;
+	if (vertex_order != ORDER_NONE)
+	{
+		old_id = generate_vertex_order(input, edge_unit, vertices, vertex_order, new_id);
+		vertices = old_id.size();
+	}
 	if (partitions == -1)
 	{
-		partitions = vertices / CHUNKSIZE;
+		if (is_regular_file(input))
+		{
+			edges = text ? estimate_text_edges(input) : file_size(input) / edge_unit;
+		}
+		partitions = plan_partitions(vertices, edges, edge_unit, memory_bytes, vertex_bytes);
+	}
+	std::vector<VertexId> bounds = uniform_partition_bounds(vertices, partitions);
+	if (balanced)
+	{
+		bounds = degree_partition_bounds(input, edge_unit, vertices, partitions, new_id.empty() ? NULL : new_id.data());
+	}
+	if (direct)
+	{
+		generate_edge_grid_direct(input, output, vertices, partitions, bounds.data(), edge_format, indexed, single_copy, sort_key, tile_vertices, new_id.empty() ? NULL : new_id.data(), vertex_order);
+	}
+	else
+	{
+		generate_edge_grid(input, text, output, vertices, partitions, bounds.data(), edge_format, compressed, indexed, single_copy, sort_key, tile_vertices, new_id.empty() ? NULL : new_id.data(), vertex_order);
+	}
+	if (vertex_order != ORDER_NONE)
+	{
+		write_vertex_mapping(output, old_id, new_id);
+	}
+	for (std::string filename : temporaries)
+	{
+		unlink(filename.c_str());
 	}
-	generate_edge_grid(input, output, vertices, partitions, edge_type);
 	return 0;
 }
@@ -0,0 +1,91 @@
+/*
+Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <tuple>
+#include <vector>
+#include <thread>
+
+#include "core/queue.hpp"
+#include "core/time.hpp"
+
+// threads producers and threads consumers pass items tuples (shaped like the I/O tasks of
+// stream_edges) through a queue of the given capacity; returns the elapsed time in seconds
+template <typename Q>
+double run(Q & queue, int threads, long items) {
+	std::vector<std::thread> workers;
+	std::vector<long> sums(threads, 0);
+	double begin_time = get_time();
+	for (int ti=0;ti<threads;ti++) {
+		workers.emplace_back([&](int thread_id){
+			for (long i=thread_id;i<items;i+=threads) {
+				queue.push(std::make_tuple((int)(i & 1023), i, 1l));
+			}
+		}, ti);
+		workers.emplace_back([&](int thread_id){
+			long local_sum = 0;
+			while (true) {
+				int slot;
+				long offset, bytes;
+				std::tie(slot, offset, bytes) = queue.pop();
+				if (slot==-1) break;
+				local_sum += offset;
+			}
+			sums[thread_id] = local_sum;
+		}, ti);
+	}
+	for (int ti=0;ti<threads;ti++) {
+		workers[ti*2].join();
+	}
+	for (int ti=0;ti<threads;ti++) {
+		queue.push(std::make_tuple(-1, 0l, 0l));
+	}
+	for (int ti=0;ti<threads;ti++) {
+		workers[ti*2+1].join();
+	}
+	double elapsed = get_time() - begin_time;
+	long sum = 0;
+	for (int ti=0;ti<threads;ti++) {
+		sum += sums[ti];
+	}
+	if (sum != items * (items - 1) / 2) {
+		fprintf(stderr, "lost items: %ld != %ld\n", sum, items * (items - 1) / 2);
+		exit(-1);
+	}
+	return elapsed;
+}
+
+int main(int argc, char ** argv) {
+	long items = (argc>=2)?atol(argv[1]):1048576;
+	long capacity = (argc>=3)?atol(argv[2]):1024;
+	int max_threads = (argc>=4)?atoi(argv[3]):64;
+	typedef std::tuple<int, long, long> Task;
+
+	printf("%ld items, capacity %ld (Mops/s, T producers + T consumers)\n", items, capacity);
+	printf("%8s %12s %12s %12s\n", "T", "mutex", "blocking", "spinning");
+	for (int threads=1;threads<=max_threads;threads*=2) {
+		LockedQueue<Task> locked(capacity);
+		Queue<Task> blocking(capacity, 0);
+		Queue<Task> spinning(capacity);
+		double locked_time = run(locked, threads, items);
+		double blocking_time = run(blocking, threads, items);
+		double spinning_time = run(spinning, threads, items);
+		printf("%8d %12.2f %12.2f %12.2f\n", threads, items / locked_time / 1e6, items / blocking_time / 1e6, items / spinning_time / 1e6);
+	}
+	return 0;
+}